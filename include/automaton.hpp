@@ -0,0 +1,84 @@
+#ifndef AUTOMATON_H_
+#define AUTOMATON_H_
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+
+namespace mmphf_fst {
+
+// Deterministic automata for FST::intersect. An automaton provides
+//   using State = ...;
+//   State start() const;
+//   State step(const State &state, label_t label) const;
+//   bool isDead(const State &state) const;   // no extension can match
+//   bool isMatch(const State &state) const;  // accepts the input so far
+//   // labels whose step does not lead to a dead state (a superset is fine),
+//   // kLabelSetWords words, most significant bit first
+//   void getLabelSet(const State &state, word_t *label_set) const;
+
+// Accepts the byte strings within Levenshtein distance max_distance of
+// pattern. A state is the current row of the dynamic programming matrix,
+// distances are capped at max_distance + 1.
+class LevenshteinAutomaton {
+ public:
+  using State = std::vector<uint32_t>;
+
+  LevenshteinAutomaton(const std::string &pattern, uint32_t max_distance)
+      : pattern_(pattern), max_distance_(max_distance) {}
+
+  State start() const {
+    State row(pattern_.size() + 1);
+    for (uint32_t i = 0; i < row.size(); i++) row[i] = cap(i);
+    return row;
+  }
+
+  State step(const State &state, const label_t label) const {
+    State row(state.size());
+    row[0] = cap(state[0] + 1);
+    for (uint32_t i = 1; i < row.size(); i++) {
+      uint32_t cost = ((label_t)pattern_[i - 1] == label) ? 0 : 1;
+      row[i] = cap(
+          std::min({state[i] + 1, state[i - 1] + cost, row[i - 1] + 1}));
+    }
+    return row;
+  }
+
+  bool isDead(const State &state) const {
+    return *std::min_element(state.begin(), state.end()) > max_distance_;
+  }
+
+  bool isMatch(const State &state) const {
+    return state.back() <= max_distance_;
+  }
+
+  // Any label keeps a state alive that has budget left. Otherwise only the
+  // pattern bytes that extend a row entry at the limit without an edit do.
+  void getLabelSet(const State &state, word_t *label_set) const {
+    if (*std::min_element(state.begin(), state.end()) < max_distance_) {
+      std::fill(label_set, label_set + kLabelSetWords, kOneMask);
+      return;
+    }
+    std::fill(label_set, label_set + kLabelSetWords, 0);
+    for (uint32_t i = 0; i < pattern_.size(); i++) {
+      if (state[i] != max_distance_) continue;
+      label_t label = pattern_[i];
+      label_set[label / kWordSize] |= kMsbMask >> (label % kWordSize);
+    }
+  }
+
+ private:
+  uint32_t cap(uint32_t distance) const {
+    return std::min(distance, max_distance_ + 1);
+  }
+
+  std::string pattern_;
+  uint32_t max_distance_;
+};
+
+}  // namespace mmphf_fst
+
+#endif  // AUTOMATON_H_
@@ -43,6 +43,12 @@ class Bitvector {
 
   bool readBit(position_t pos) const;
 
+  // bits in position order, most significant bit first
+  word_t getWord(position_t word_id) const {
+    assert(word_id < numWords());
+    return bits_[word_id];
+  }
+
   position_t distanceToNextSetBit(position_t pos) const;
   position_t distanceToPrevSetBit(position_t pos) const;
 
@@ -61,6 +67,8 @@ class Bitvector {
  protected:
   position_t num_bits_;
   word_t *bits_;
+  // bits_ points into a mapped image, see loadArray
+  bool is_mapped_ = false;
 };
 
 bool Bitvector::readBit(const position_t pos) const {
@@ -73,6 +81,7 @@ bool Bitvector::readBit(const position_t pos) const {
 position_t Bitvector::distanceToNextSetBit(const position_t pos) const {
   assert(pos < num_bits_);
   position_t distance = 1;
+  if (pos + 1 == num_bits_) return distance;  // no bits left
 
   position_t word_id = (pos + 1) / kWordSize;
   position_t offset = (pos + 1) % kWordSize;
@@ -92,7 +101,8 @@ position_t Bitvector::distanceToNextSetBit(const position_t pos) const {
     if (test_bits > 0) return (distance + __builtin_clzll(test_bits));
     distance += kWordSize;
   }
-  return distance;
+  // no set bit after pos: the distance to the end, not to the last word's end
+  return num_bits_ - pos;
 }
 
 size_t Bitvector::getNumSetBitsInDenseNode(position_t nodeNumber,
@@ -171,7 +181,9 @@ void Bitvector::concatenateBitvectors(
         bit_shift += bits_remain;
       } else {
         word_id++;
-        bits_[word_id] |= (last_word << (kWordSize - bit_shift));
+        // nothing spills over if the remaining bits fill the word exactly
+        if (bit_shift + bits_remain > kWordSize)
+          bits_[word_id] |= (last_word << (kWordSize - bit_shift));
         bit_shift = bit_shift + bits_remain - kWordSize;
       }
     }
@@ -0,0 +1,143 @@
+#ifndef BLOOMFILTER_H_
+#define BLOOMFILTER_H_
+
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "config.hpp"
+#include "hash.hpp"
+
+namespace mmphf_fst {
+
+// Blocked Bloom filter: all probes of a key fall into the same 512 bit block,
+// i.e., a negative lookup costs at most one cache miss.
+class BlockedBloomFilter {
+ public:
+  BlockedBloomFilter() : num_blocks_(0), num_probes_(0), blocks_(nullptr){};
+
+  BlockedBloomFilter(const uint64_t num_keys, const uint32_t bits_per_key) {
+    num_blocks_ = (num_keys * bits_per_key + kBlockBits - 1) / kBlockBits;
+    if (num_blocks_ == 0) num_blocks_ = 1;
+    // k = ln(2) * bits per key minimizes the false positive rate
+    num_probes_ = (uint32_t)std::lround(bits_per_key * 0.69);
+    if (num_probes_ < 1) num_probes_ = 1;
+    if (num_probes_ > kMaxProbes) num_probes_ = kMaxProbes;
+    blocks_ = new Block[num_blocks_]();
+  }
+
+  ~BlockedBloomFilter() { delete[] blocks_; }
+
+  void insert(const char *key, const size_t key_length) {
+    uint64_t hash = keyHash(key, key_length);
+    Block &block = blocks_[blockIndex(hash)];
+    uint32_t bit = hash & (kBlockBits - 1);
+    uint32_t delta = ((hash >> 9) & (kBlockBits - 1)) | 1;
+    for (uint32_t i = 0; i < num_probes_; i++) {
+      block.words[bit / kWordSize] |= (kMsbMask >> (bit % kWordSize));
+      bit = (bit + delta) & (kBlockBits - 1);
+    }
+  }
+
+  void insert(const std::string &key) { insert(key.data(), key.length()); }
+
+  // false means the key is definitely not in the set
+  bool mayContain(const char *key, const size_t key_length) const {
+    uint64_t hash = keyHash(key, key_length);
+    const Block &block = blocks_[blockIndex(hash)];
+    uint32_t bit = hash & (kBlockBits - 1);
+    uint32_t delta = ((hash >> 9) & (kBlockBits - 1)) | 1;
+    for (uint32_t i = 0; i < num_probes_; i++) {
+      if (!(block.words[bit / kWordSize] & (kMsbMask >> (bit % kWordSize))))
+        return false;
+      bit = (bit + delta) & (kBlockBits - 1);
+    }
+    return true;
+  }
+
+  bool mayContain(const std::string &key) const {
+    return mayContain(key.data(), key.length());
+  }
+
+  void prefetch(const char *key, const size_t key_length) const {
+    __builtin_prefetch(&blocks_[blockIndex(keyHash(key, key_length))]);
+  }
+
+  uint64_t numBlocks() const { return num_blocks_; }
+
+  uint32_t numProbes() const { return num_probes_; }
+
+  // in bytes
+  uint64_t blocksSize() const { return num_blocks_ * sizeof(Block); }
+
+  uint64_t size() const { return sizeof(BlockedBloomFilter) + blocksSize(); }
+
+  uint64_t serializedSize() const {
+    uint64_t size = sizeof(num_blocks_) + sizeof(num_probes_) + blocksSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&num_blocks_, sizeof(num_blocks_));
+    out.write(&num_probes_, sizeof(num_probes_));
+    out.write(blocks_, blocksSize());
+    out.align();
+  }
+
+  // nullptr if the filter runs past end, see fitsImage
+  static std::unique_ptr<BlockedBloomFilter> deSerialize(
+      char *&src, const char *end = nullptr) {
+    auto filter = std::make_unique<BlockedBloomFilter>();
+    if (!fitsImage(src, end,
+                   sizeof(filter->num_blocks_) + sizeof(filter->num_probes_)))
+      return nullptr;
+    memcpy(&(filter->num_blocks_), src, sizeof(filter->num_blocks_));
+    src += sizeof(filter->num_blocks_);
+    memcpy(&(filter->num_probes_), src, sizeof(filter->num_probes_));
+    src += sizeof(filter->num_probes_);
+    if (filter->num_probes_ > kMaxProbes ||
+        !fitsImage(src, end, filter->num_blocks_, sizeof(Block)))
+      return nullptr;
+    // copy into cache line aligned blocks
+    filter->blocks_ = new Block[filter->num_blocks_];
+    memcpy(filter->blocks_, src, filter->blocksSize());
+    src += filter->blocksSize();
+    align(src);
+    return filter;
+  }
+
+ private:
+  static const uint32_t kBlockBits = 512;
+  static const uint32_t kMaxProbes = 16;
+
+  struct alignas(64) Block {
+    word_t words[kBlockBits / kWordSize];
+  };
+
+  static uint64_t keyHash(const char *key, const size_t key_length) {
+    // spread the 32 bit hash over 64 bits (splitmix64 finalizer)
+    uint64_t hash = Hash(key, key_length, 0x9747b28c);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+  }
+
+  // maps the upper 32 hash bits to [0, num_blocks_) without a division
+  uint64_t blockIndex(const uint64_t hash) const {
+    return ((hash >> 32) * num_blocks_) >> 32;
+  }
+
+  uint64_t num_blocks_;
+  uint32_t num_probes_;
+  Block *blocks_;
+};
+
+const uint32_t BlockedBloomFilter::kBlockBits;
+const uint32_t BlockedBloomFilter::kMaxProbes;
+
+}  // namespace mmphf_fst
+
+#endif  // BLOOMFILTER_H_
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <string>
 
 namespace mmphf_fst {
 
@@ -17,6 +18,9 @@ static const unsigned kWordSize = 64;
 static const word_t kMsbMask = 0x8000000000000000;
 static const word_t kOneMask = 0xFFFFFFFFFFFFFFFF;
 
+// words of a label set, one bit per label (most significant bit first)
+static const unsigned kLabelSetWords = kFanout / kWordSize;
+
 static const bool kIncludeDense = true;
 // static const uint32_t kSparseDenseRatio = 64;
 static const uint32_t kSparseDenseRatio = 16;
@@ -24,6 +28,31 @@ static const label_t kTerminator = 255;
 
 static const int kHashShift = 7;
 
+// per leaf suffix bits, see BitvectorSuffix
+enum SuffixType { kNone = 0, kHash = 1, kReal = 2 };
+// suffixHash is 32 bits wide, longer kHash suffixes are clamped to it
+static const level_t kMaxHashSuffixLen = 32;
+
+// Per trie level statistics, see FST::getLevelStats
+struct LevelStats {
+  level_t level;
+  bool is_dense;
+  uint64_t node_count;
+  uint64_t label_count;
+  uint64_t child_count;  // labels that lead to a child node
+  uint64_t value_count;  // labels (and prefix keys) that terminate in a value
+};
+
+// One outgoing label of a trie node, see LoudsDense::getNodeLabels. A key
+// that ends at the node (a prefix of other keys) comes first, as a leaf
+// without label.
+struct NodeLabel {
+  label_t label;
+  bool has_child;
+  position_t next;  // child node number, or the leaf's index in value order
+  bool is_prefix_key = false;
+};
+
 void align(char *&ptr) { ptr = (char *)(((uint64_t)ptr + 7) & ~((uint64_t)7)); }
 
 void sizeAlign(position_t &size) { size = (size + 7) & ~((position_t)7); }
@@ -46,6 +75,66 @@ uint64_t stringToUint64(const std::string &str_word) {
   return __builtin_bswap64(int_word);
 }
 
+// LEB128 varints, e.g., for iterator tokens (see FST::Iter::saveToken)
+inline void appendVarint(std::string &dst, uint64_t value) {
+  while (value >= 0x80) {
+    dst.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  dst.push_back((char)value);
+}
+
+// false if src ends before the varint does
+inline bool readVarint(const char *&src, const char *end, uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; src < end && shift < 64; shift += 7) {
+    uint8_t byte = (uint8_t)*src++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+// For deSerialize of an image that may be truncated or corrupt: true if
+// count elements of element_size bytes at src end before end. A null end
+// trusts the image.
+inline bool fitsImage(const char *src, const char *end, const uint64_t count,
+                      const uint64_t element_size = 1) {
+  return end == nullptr ||
+         (src <= end && count <= (uint64_t)(end - src) / element_size);
+}
+
+// serialize destination that copies into memory: writes at dst and advances
+// it, see FileWriter for the streaming one
+class BufferWriter {
+ public:
+  explicit BufferWriter(char *&dst) : dst_(dst) {}
+
+  void write(const void *src, const uint64_t num_bytes) {
+    if (num_bytes > 0) memcpy(dst_, src, num_bytes);
+    dst_ += num_bytes;
+  }
+
+  // skips to the next word boundary, see align
+  void align() { mmphf_fst::align(dst_); }
+
+ private:
+  char *&dst_;
+};
+
+// An array of num_bytes bytes at src, for deSerialize: with map set, src
+// itself if it is suitably aligned (the image must then outlive the
+// reader), otherwise an owned copy. is_mapped tells the destructor which.
+template <typename T>
+T *loadArray(char *src, const uint64_t num_bytes, const bool map,
+             bool &is_mapped) {
+  is_mapped = map && (uint64_t)src % alignof(T) == 0;
+  if (is_mapped) return reinterpret_cast<T *>(src);
+  T *array = new T[(num_bytes + sizeof(T) - 1) / sizeof(T)];
+  if (num_bytes > 0) memcpy(array, src, num_bytes);
+  return array;
+}
+
 }  // namespace mmphf_fst
 
 #endif  // CONFIG_H_
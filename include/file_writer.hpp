@@ -0,0 +1,97 @@
+#ifndef FILEWRITER_H_
+#define FILEWRITER_H_
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include "config.hpp"
+
+namespace mmphf_fst {
+
+// serialize destination that streams to a file descriptor (see
+// BufferWriter). Small fields are gathered in a buffer, arrays that do not
+// fit are written straight from their memory together with the buffered
+// bytes (one writev), so no component is ever copied whole.
+class FileWriter {
+ public:
+  static const uint64_t kBufferSize = 64 << 10;
+
+  explicit FileWriter(const int fd) : fd_(fd) { buffer_.reserve(kBufferSize); }
+
+  void write(const void *src, const uint64_t num_bytes) {
+    if (!ok_ || num_bytes == 0) return;
+    offset_ += num_bytes;
+    const char *bytes = (const char *)src;
+    if (buffer_.size() + num_bytes > kBufferSize && num_bytes < kBufferSize)
+      flush();
+    if (buffer_.size() + num_bytes <= kBufferSize) {
+      buffer_.insert(buffer_.end(), bytes, bytes + num_bytes);
+      return;
+    }
+    writeAll(buffer_.data(), buffer_.size(), bytes, num_bytes);
+    buffer_.clear();
+  }
+
+  // pads with zeros to the next word boundary of the stream, see align
+  void align() {
+    static const char kZeros[8] = {};
+    write(kZeros, (8 - offset_ % 8) % 8);
+  }
+
+  // bytes written so far
+  uint64_t getOffset() const { return offset_; }
+
+  // Writes out the buffer and, with sync, waits until the file reached the
+  // disk (fsync). False if any write failed.
+  bool finish(const bool sync) {
+    flush();
+    if (ok_ && sync && fsync(fd_) != 0) ok_ = false;
+    return ok_;
+  }
+
+ private:
+  void flush() {
+    writeAll(buffer_.data(), buffer_.size(), nullptr, 0);
+    buffer_.clear();
+  }
+
+  // writes first and then second, resuming after partial writes
+  void writeAll(const char *first, const uint64_t first_len,
+                const char *second, const uint64_t second_len) {
+    iovec iov[2] = {{(void *)first, first_len}, {(void *)second, second_len}};
+    int next = 0;
+    while (ok_ && next < 2) {
+      if (iov[next].iov_len == 0) {
+        next++;
+        continue;
+      }
+      ssize_t written = ::writev(fd_, iov + next, 2 - next);
+      if (written < 0) {
+        if (errno != EINTR) ok_ = false;
+        continue;
+      }
+      while (written > 0) {
+        size_t len = std::min<size_t>(written, iov[next].iov_len);
+        iov[next].iov_base = (char *)iov[next].iov_base + len;
+        iov[next].iov_len -= len;
+        written -= len;
+        if (iov[next].iov_len == 0) next++;
+      }
+    }
+  }
+
+  int fd_;
+  bool ok_ = true;
+  uint64_t offset_ = 0;
+  std::vector<char> buffer_;
+};
+
+const uint64_t FileWriter::kBufferSize;
+
+}  // namespace mmphf_fst
+
+#endif  // FILEWRITER_H_
@@ -1,31 +1,50 @@
 #ifndef FSTBUILDER_H_
 #define FSTBUILDER_H_
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <vector>
 
+#include "bloom_filter.hpp"
 #include "config.hpp"
 #include "hash.hpp"
+#include "key_stats.hpp"
+#include "suffix.hpp"
 
 namespace mmphf_fst {
 
 class FSTBuilder {
  public:
   FSTBuilder() : sparse_start_level_(0){};
-  explicit FSTBuilder(bool include_dense, uint32_t sparse_dense_ratio)
+  explicit FSTBuilder(bool include_dense, uint32_t sparse_dense_ratio,
+                      uint32_t bloom_bits_per_key = 0,
+                      SuffixType suffix_type = kNone, level_t suffix_len = 0)
       : include_dense_(include_dense),
         sparse_dense_ratio_(sparse_dense_ratio),
-        sparse_start_level_(0){};
+        bloom_bits_per_key_(bloom_bits_per_key),
+        suffix_type_(suffix_len == 0 ? kNone : suffix_type),
+        suffix_len_(suffix_type == kNone ? 0 : suffix_len),
+        sparse_start_level_(0) {
+    // wider hashed suffixes would only store zero bits
+    if (suffix_type_ == kHash)
+      suffix_len_ = std::min(suffix_len_, kMaxHashSuffixLen);
+  }
 
   ~FSTBuilder() = default;
 
   // Fills in the LOUDS-dense and sparse vectors (members of this class)
   // through a single scan of the sorted key list.
   // After build, the member vectors are used in FST constructor.
-  // REQUIRED: provided key list must be sorted.
+  // REQUIRED: provided key list must be sorted. Keys must not be empty but
+  // may be prefixes of other keys.
   void build(const std::vector<std::string> &keys);
 
+  // Same as build(keys) but stores values[i] for keys[i] instead of the key
+  // position i. Used to re-encode an existing FST.
+  void build(const std::vector<std::string> &keys,
+             const std::vector<uint64_t> &values);
+
   static bool readBit(const std::vector<word_t> &bits, const position_t pos) {
     assert(pos < (bits.size() * kWordSize));
     position_t word_id = pos / kWordSize;
@@ -67,6 +86,23 @@ class FSTBuilder {
 
   std::vector<uint64_t> getSparseOffsets() const { return positions_sparse_; }
 
+  SuffixType getSuffixType() const { return suffix_type_; }
+  level_t getSuffixLen() const { return suffix_len_; }
+  // in the same order as the dense/sparse offsets
+  const std::vector<uint64_t> &getDenseSuffixes() const {
+    return suffixes_dense_;
+  }
+  const std::vector<uint64_t> &getSparseSuffixes() const {
+    return suffixes_sparse_;
+  }
+
+  // nullptr unless the builder was created with bloom_bits_per_key > 0
+  std::unique_ptr<BlockedBloomFilter> releaseBloomFilter() {
+    return std::move(bloom_filter_);
+  }
+
+  std::unique_ptr<KeyStats> releaseKeyStats() { return std::move(key_stats_); }
+
  private:
   static bool isSameKey(const std::string &a, const std::string &b) {
     return a == b;
@@ -74,7 +110,8 @@ class FSTBuilder {
 
   // Fill in the LOUDS-Sparse vectors through a single scan
   // of the sorted key list.
-  void buildSparse(const std::vector<std::string> &keys);
+  void buildSparse(const std::vector<std::string> &keys,
+                   const std::vector<uint64_t> *values);
 
   // Walks down the current partially-filled trie by comparing key to
   // its previous key in the list until their prefixes do not match.
@@ -94,17 +131,31 @@ class FSTBuilder {
                                           const std::string &next_key,
                                           level_t start_level);
 
+  // Stores the value (and suffix) of key, whose unique prefix has length
+  // prefix_len (including the terminator of a prefix key), at the leaf level
+  // prefix_len - 1
+  inline void insertValue(const std::string &key, uint64_t position,
+                          level_t prefix_len);
+
   inline bool isCharCommonPrefix(label_t c, level_t level) const;
   inline bool isLevelEmpty(level_t level) const;
   inline void moveToNextItemSlot(level_t level);
   void insertKeyByte(char c, level_t level, bool is_start_of_node,
                      bool is_term);
 
+  // Fills key_stats_ from the keys and the per level LOUDS-Sparse vectors,
+  // which hold every level at this point
+  void buildKeyStats(const std::vector<std::string> &keys, bool has_values);
+
   // Compute sparse_start_level_ according to the pre-defined
   // size ratio between Sparse and Dense levels.
   // Dense size < Sparse size / sparse_dense_ratio_
   inline void determineCutoffLevel();
 
+  // Distribute the per level values to positions_dense_ and
+  // positions_sparse_ according to sparse_start_level_.
+  inline void splitPositions();
+
   inline uint64_t computeDenseMem(level_t downto_level) const;
   inline uint64_t computeSparseMem(level_t start_level) const;
 
@@ -127,9 +178,21 @@ class FSTBuilder {
   // trie level >= sparse_start_level_: LOUDS-Sparse
   bool include_dense_{};
   uint32_t sparse_dense_ratio_{};
+  uint32_t bloom_bits_per_key_{};
+  SuffixType suffix_type_{kNone};
+  level_t suffix_len_{};
   level_t sparse_start_level_;
 
+  // optional pre-filter, filled during buildSparse
+  std::unique_ptr<BlockedBloomFilter> bloom_filter_;
+  // statistics sidecar, filled after buildSparse
+  std::unique_ptr<KeyStats> key_stats_;
+
   std::vector<std::vector<uint64_t>> positions_;
+  // per level leaf suffixes, parallel to positions_ (empty for kNone)
+  std::vector<std::vector<uint64_t>> suffixes_;
+  std::vector<uint64_t> suffixes_dense_;
+  std::vector<uint64_t> suffixes_sparse_;
 
   // LOUDS-Sparse bit/byte vectors
   std::vector<std::vector<label_t>> labels_;
@@ -150,26 +213,68 @@ class FSTBuilder {
 
 void FSTBuilder::build(const std::vector<std::string> &keys) {
   assert(keys.size() > 0);
-  buildSparse(keys);
+  buildSparse(keys, nullptr);
+  buildKeyStats(keys, false);
+  if (include_dense_) {
+    determineCutoffLevel();
+    buildDense();
+  }
+  splitPositions();
+}
+
+void FSTBuilder::build(const std::vector<std::string> &keys,
+                       const std::vector<uint64_t> &values) {
+  assert(keys.size() > 0);
+  assert(keys.size() == values.size());
+  buildSparse(keys, &values);
+  buildKeyStats(keys, true);
   if (include_dense_) {
     determineCutoffLevel();
     buildDense();
   }
+  splitPositions();
 }
 
-void FSTBuilder::buildSparse(const std::vector<std::string> &keys) {
+void FSTBuilder::buildSparse(const std::vector<std::string> &keys,
+                             const std::vector<uint64_t> *values) {
+  if (bloom_bits_per_key_ > 0)
+    bloom_filter_ =
+        std::make_unique<BlockedBloomFilter>(keys.size(), bloom_bits_per_key_);
   for (position_t i = 0; i < keys.size(); i++) {
+    if (bloom_filter_) bloom_filter_->insert(keys[i]);
     level_t level = skipCommonPrefix(keys[i]);
     position_t curpos = i;
+    uint64_t value = values ? (*values)[curpos] : curpos;
     while ((i + 1 < keys.size()) && isSameKey(keys[curpos], keys[i + 1])) i++;
     if (i < keys.size() - 1)
-      insertKeyBytesToTrieUntilUnique(keys[curpos], curpos, keys[i + 1], level);
+      insertKeyBytesToTrieUntilUnique(keys[curpos], value, keys[i + 1], level);
     else  // for last key, there is no successor key in the list
-      insertKeyBytesToTrieUntilUnique(keys[curpos], curpos, std::string(),
+      insertKeyBytesToTrieUntilUnique(keys[curpos], value, std::string(),
                                       level);
   }
 }
 
+void FSTBuilder::buildKeyStats(const std::vector<std::string> &keys,
+                               const bool has_values) {
+  // a duplicate key keeps the position of its first occurrence
+  bool has_duplicates = false;
+  for (uint64_t i = 1; i < keys.size() && !has_duplicates; i++)
+    has_duplicates = isSameKey(keys[i - 1], keys[i]);
+  key_stats_ = std::make_unique<KeyStats>(keys, !has_values && !has_duplicates);
+
+  for (level_t level = 0; level < getTreeHeight(); level++) {
+    position_t fanout = 0;
+    for (position_t pos = 0; pos < getNumItems(level); pos++) {
+      if (isStartOfNode(level, pos) && fanout > 0) {
+        key_stats_->addNode(level, fanout);
+        fanout = 0;
+      }
+      fanout++;
+    }
+    if (fanout > 0) key_stats_->addNode(level, fanout);
+  }
+}
+
 level_t FSTBuilder::skipCommonPrefix(const std::string &key) {
   level_t level = 0;
   while (level < key.length() &&
@@ -201,7 +306,7 @@ level_t FSTBuilder::insertKeyBytesToTrieUntilUnique(const std::string &key,
 
   if (level > next_key.length() ||
       !isSameKey(key.substr(0, level), next_key.substr(0, level))) {
-    positions_[level - 1].emplace_back(position);
+    insertValue(key, position, level);
     return level;
   }
 
@@ -213,10 +318,27 @@ level_t FSTBuilder::insertKeyBytesToTrieUntilUnique(const std::string &key,
     insertKeyByte(key[level], level, is_start_of_node, is_term);
     level++;
   }
-  positions_[level - 1].emplace_back(position);
+
+  // key is a prefix of next_key: a terminator label, the first item of the
+  // node below the last key byte, holds its value
+  if (level == key.length() && key[level - 1] == next_key[level - 1]) {
+    is_term = true;
+    insertKeyByte(kTerminator, level, is_start_of_node, is_term);
+    level++;
+  }
+  insertValue(key, position, level);
   return level;
 }
 
+inline void FSTBuilder::insertValue(const std::string &key,
+                                    const uint64_t position,
+                                    const level_t prefix_len) {
+  positions_[prefix_len - 1].emplace_back(position);
+  if (suffix_type_ != kNone)
+    suffixes_[prefix_len - 1].emplace_back(BitvectorSuffix::constructSuffix(
+        suffix_type_, suffix_len_, key, prefix_len));
+}
+
 inline bool FSTBuilder::isCharCommonPrefix(const label_t c,
                                            const level_t level) const {
   return (level < getTreeHeight()) && (!is_last_item_terminator_[level]) &&
@@ -270,7 +392,9 @@ inline void FSTBuilder::determineCutoffLevel() {
   }
   // cutoff_level = 3;
   sparse_start_level_ = cutoff_level--;
+}
 
+inline void FSTBuilder::splitPositions() {
   // CA build dense and sparse values vectors
   for (uint64_t level = 0; level < sparse_start_level_; level++) {
     positions_dense_.insert(positions_dense_.end(), positions_[level].begin(),
@@ -283,6 +407,15 @@ inline void FSTBuilder::determineCutoffLevel() {
                              positions_[level].end());
   }
   positions_.clear();
+
+  if (suffix_type_ == kNone) return;
+  for (uint64_t level = 0; level < suffixes_.size(); level++) {
+    auto &suffixes =
+        level < sparse_start_level_ ? suffixes_dense_ : suffixes_sparse_;
+    suffixes.insert(suffixes.end(), suffixes_[level].begin(),
+                    suffixes_[level].end());
+  }
+  suffixes_.clear();
 }
 
 inline uint64_t FSTBuilder::computeDenseMem(const level_t downto_level) const {
@@ -353,6 +486,7 @@ void FSTBuilder::setLabelAndChildIndicatorBitmap(const level_t level,
 void FSTBuilder::addLevel() {
   labels_.emplace_back(std::vector<label_t>());
   positions_.emplace_back(std::vector<uint64_t>());
+  suffixes_.emplace_back(std::vector<uint64_t>());
   child_indicator_bits_.emplace_back(std::vector<word_t>());
   louds_bits_.emplace_back(std::vector<word_t>());
 
@@ -374,8 +508,10 @@ bool FSTBuilder::isStartOfNode(const level_t level,
 
 bool FSTBuilder::isTerminator(const level_t level, const position_t pos) const {
   label_t label = labels_[level][pos];
+  // a terminator never is the only item of its node, unlike a real 0xFF leaf
   return ((label == kTerminator) &&
-          !readBit(child_indicator_bits_[level], pos));
+          !readBit(child_indicator_bits_[level], pos) &&
+          (pos + 1 < getNumItems(level)) && !isStartOfNode(level, pos + 1));
 }
 }  // namespace mmphf_fst
 
@@ -1,6 +1,8 @@
 #ifndef HASH_H_
 #define HASH_H_
 
+#include <cstdint>
+#include <cstring>
 #include <string>
 
 namespace mmphf_fst {
@@ -34,8 +36,10 @@ inline uint32_t Hash(const char *data, size_t n, uint32_t seed) {
   switch (limit - data) {
     case 3:
       h += static_cast<unsigned char>(data[2]) << 16u;
+      [[fallthrough]];
     case 2:
       h += static_cast<unsigned char>(data[1]) << 8u;
+      [[fallthrough]];
     case 1:
       h += static_cast<unsigned char>(data[0]);
       h *= m;
@@ -0,0 +1,221 @@
+#ifndef KEYSTATS_H_
+#define KEYSTATS_H_
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.hpp"
+
+namespace mmphf_fst {
+
+// Statistics sidecar for query planning, filled by FSTBuilder::build: a
+// fanout histogram per trie level and an equi-depth histogram over the
+// keys, whose boundaries are the keys at up to kMaxBuckets + 1 evenly
+// spaced positions. The node and label counts per level come from
+// FST::getLevelStats.
+class KeyStats {
+ public:
+  // fanout histogram buckets: [1], [2, 3], [4, 7], ..., [128, 255], [256]
+  static const uint32_t kFanoutBuckets = 9;
+  // upper bound on the number of equi-depth buckets
+  static const uint64_t kMaxBuckets = 64;
+  // boundary keys are cut after this many bytes
+  static const uint32_t kBoundaryLen = 16;
+
+  KeyStats() : num_keys_(0), values_are_ranks_(0) {}
+
+  // keys are the sorted build keys, values_are_ranks tells whether the FST
+  // stores each key's rank (no explicit values, no duplicates)
+  KeyStats(const std::vector<std::string> &keys, const bool values_are_ranks)
+      : num_keys_(keys.size()), values_are_ranks_(values_are_ranks) {
+    if (keys.empty()) return;
+    uint64_t num_buckets = std::min<uint64_t>(kMaxBuckets, keys.size());
+    boundary_offsets_.push_back(0);
+    for (uint64_t bucket = 0; bucket <= num_buckets; bucket++) {
+      // the last boundary is the last key
+      uint64_t rank = bucket == num_buckets
+                          ? keys.size() - 1
+                          : bucket * keys.size() / num_buckets;
+      boundaries_.append(keys[rank], 0, kBoundaryLen);
+      boundary_offsets_.push_back(boundaries_.size());
+      boundary_ranks_.push_back(rank);
+    }
+  }
+
+  // counts a node with fanout labels (a prefix key counts as a label)
+  void addNode(const level_t level, const position_t fanout) {
+    assert(fanout > 0);
+    if (fanout_counts_.size() < (level + 1) * kFanoutBuckets)
+      fanout_counts_.resize((level + 1) * kFanoutBuckets, 0);
+    uint32_t bucket = std::min<uint32_t>(63 - __builtin_clzll(fanout),
+                                         kFanoutBuckets - 1);
+    fanout_counts_[level * kFanoutBuckets + bucket]++;
+  }
+
+  uint64_t getNumKeys() const { return num_keys_; }
+
+  bool valuesAreRanks() const { return values_are_ranks_; }
+
+  level_t getNumLevels() const {
+    return fanout_counts_.size() / kFanoutBuckets;
+  }
+
+  // number of nodes of level with a fanout in [2^bucket, 2^(bucket + 1))
+  uint64_t getFanoutCount(const level_t level, const uint32_t bucket) const {
+    return fanout_counts_[level * kFanoutBuckets + bucket];
+  }
+
+  uint64_t getNumBuckets() const {
+    return boundary_ranks_.empty() ? 0 : boundary_ranks_.size() - 1;
+  }
+
+  // Estimated number of keys smaller than key: the equi-depth bucket of key
+  // by binary search over the boundaries, then a linear interpolation
+  // between the bucket's boundaries on the 8 bytes after their common
+  // prefix.
+  double estimateRank(const std::string &key) const {
+    uint64_t num_buckets = getNumBuckets();
+    if (num_buckets == 0 || compareBoundary(key, 0) <= 0) return 0;
+    if (compareBoundary(key, num_buckets) > 0) return num_keys_;
+    // the last boundary <= key
+    uint64_t lo = 0, hi = num_buckets;
+    while (hi - lo > 1) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (compareBoundary(key, mid) >= 0)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    std::string_view left = getBoundary(lo), right = getBoundary(lo + 1);
+    size_t common = 0;
+    while (common < left.size() && common < right.size() &&
+           left[common] == right[common])
+      common++;
+    double left_word = loadWord(left, common);
+    double right_word = loadWord(right, common);
+    double word = std::clamp(loadWord(key, common), left_word, right_word);
+    double fraction =
+        right_word > left_word ? (word - left_word) / (right_word - left_word)
+                               : 0;
+    // the last boundary is a key of the bucket, not the next one
+    uint64_t right_rank = boundary_ranks_[lo + 1] + (lo + 1 == num_buckets);
+    return boundary_ranks_[lo] + fraction * (right_rank - boundary_ranks_[lo]);
+  }
+
+  uint64_t size() const {
+    return sizeof(KeyStats) + boundaries_.size() +
+           (boundary_offsets_.size() + boundary_ranks_.size() +
+            fanout_counts_.size()) *
+               8;
+  }
+
+  uint64_t serializedSize() const {
+    uint64_t size = sizeof(num_keys_) + sizeof(values_are_ranks_) +
+                    sizeof(uint64_t) + boundaries_.size();
+    sizeAlign(size);
+    size += 3 * sizeof(uint64_t) + (boundary_offsets_.size() +
+                                    boundary_ranks_.size() +
+                                    fanout_counts_.size()) *
+                                       8;
+    return size;
+  }
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&num_keys_, sizeof(num_keys_));
+    out.write(&values_are_ranks_, sizeof(values_are_ranks_));
+    uint64_t num_bytes = boundaries_.size();
+    out.write(&num_bytes, sizeof(num_bytes));
+    out.write(boundaries_.data(), num_bytes);
+    out.align();
+    serializeVector(boundary_offsets_, out);
+    serializeVector(boundary_ranks_, out);
+    serializeVector(fanout_counts_, out);
+  }
+
+  // nullptr if the statistics run past end, see fitsImage
+  static std::unique_ptr<KeyStats> deSerialize(char *&src,
+                                               const char *end = nullptr) {
+    auto stats = std::make_unique<KeyStats>();
+    uint64_t num_bytes = 0;
+    if (!fitsImage(src, end, 3 * sizeof(uint64_t))) return nullptr;
+    memcpy(&(stats->num_keys_), src, sizeof(stats->num_keys_));
+    src += sizeof(stats->num_keys_);
+    memcpy(&(stats->values_are_ranks_), src, sizeof(stats->values_are_ranks_));
+    src += sizeof(stats->values_are_ranks_);
+    memcpy(&num_bytes, src, sizeof(num_bytes));
+    src += sizeof(num_bytes);
+    if (!fitsImage(src, end, num_bytes)) return nullptr;
+    stats->boundaries_.assign(src, num_bytes);
+    src += num_bytes;
+    align(src);
+    if (!deSerializeVector(stats->boundary_offsets_, src, end) ||
+        !deSerializeVector(stats->boundary_ranks_, src, end) ||
+        !deSerializeVector(stats->fanout_counts_, src, end))
+      return nullptr;
+    return stats;
+  }
+
+ private:
+  std::string_view getBoundary(const uint64_t i) const {
+    return std::string_view(boundaries_.data() + boundary_offsets_[i],
+                            boundary_offsets_[i + 1] - boundary_offsets_[i]);
+  }
+
+  // orders key against the i-th boundary, which may be cut
+  int compareBoundary(const std::string &key, const uint64_t i) const {
+    return std::string_view(key).substr(0, kBoundaryLen).compare(
+        getBoundary(i));
+  }
+
+  // the 8 bytes of key after skip as a big endian number, zero padded
+  static double loadWord(std::string_view key, const size_t skip) {
+    uint64_t word = 0;
+    for (size_t i = skip; i < skip + 8; i++)
+      word = (word << 8) | (i < key.size() ? (uint8_t)key[i] : 0);
+    return (double)word;
+  }
+
+  template <typename Writer>
+  static void serializeVector(const std::vector<uint64_t> &vec, Writer &out) {
+    uint64_t num_elements = vec.size();
+    out.write(&num_elements, sizeof(num_elements));
+    out.write(vec.data(), num_elements * 8);
+  }
+
+  // false if the vector runs past end
+  static bool deSerializeVector(std::vector<uint64_t> &vec, char *&src,
+                                const char *end) {
+    uint64_t num_elements = 0;
+    if (!fitsImage(src, end, sizeof(num_elements))) return false;
+    memcpy(&num_elements, src, sizeof(num_elements));
+    src += sizeof(num_elements);
+    if (!fitsImage(src, end, num_elements, 8)) return false;
+    vec.resize(num_elements);
+    if (num_elements > 0) memcpy(vec.data(), src, num_elements * 8);
+    src += num_elements * 8;
+    return true;
+  }
+
+  uint64_t num_keys_;
+  uint64_t values_are_ranks_;
+  // boundary i is boundaries_[boundary_offsets_[i], boundary_offsets_[i + 1])
+  // and the key with rank boundary_ranks_[i]
+  std::string boundaries_;
+  std::vector<uint64_t> boundary_offsets_;
+  std::vector<uint64_t> boundary_ranks_;
+  // kFanoutBuckets node counts per level
+  std::vector<uint64_t> fanout_counts_;
+};
+
+const uint32_t KeyStats::kFanoutBuckets;
+const uint64_t KeyStats::kMaxBuckets;
+const uint32_t KeyStats::kBoundaryLen;
+
+}  // namespace mmphf_fst
+
+#endif  // KEYSTATS_H_
@@ -34,7 +34,9 @@ class LabelVector {
     }
   }
 
-  ~LabelVector() { delete[] labels_; }
+  ~LabelVector() {
+    if (!is_mapped_) delete[] labels_;
+  }
 
   position_t getNumBytes() const { return num_bytes_; }
 
@@ -44,15 +46,26 @@ class LabelVector {
     return size;
   }
 
-  position_t size() const { return (sizeof(LabelVector) + num_bytes_); }
+  // in-memory bytes, mapped labels excluded
+  position_t size() const {
+    return sizeof(LabelVector) + (is_mapped_ ? 0 : num_bytes_);
+  }
 
   label_t read(const position_t pos) const { return labels_[pos]; }
 
   label_t operator[](const position_t pos) const { return labels_[pos]; }
 
+  void prefetch(const position_t pos) const {
+    __builtin_prefetch(labels_ + pos);
+  }
+
   bool search(label_t target, position_t &pos, position_t search_len) const;
   bool searchGreaterThan(label_t target, position_t &pos,
                          position_t search_len) const;
+  // moves pos to the greatest label smaller than target, a leading
+  // terminator is not a label
+  bool searchLessThan(label_t target, position_t &pos,
+                      position_t search_len) const;
 
   bool binarySearch(label_t target, position_t &pos,
                     position_t search_len) const;
@@ -65,19 +78,30 @@ class LabelVector {
   bool linearSearchGreaterThan(label_t target, position_t &pos,
                                position_t search_len) const;
 
-  void serialize(char *&dst) const {
-    memcpy(dst, &num_bytes_, sizeof(num_bytes_));
-    dst += sizeof(num_bytes_);
-    memcpy(dst, labels_, num_bytes_);
-    dst += num_bytes_;
-    align(dst);
+  bool binarySearchLessThan(label_t target, position_t &pos,
+                            position_t search_len) const;
+  bool linearSearchLessThan(label_t target, position_t &pos,
+                            position_t search_len) const;
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&num_bytes_, sizeof(num_bytes_));
+    out.write(labels_, num_bytes_);
+    out.align();
   }
 
-  static std::unique_ptr<LabelVector> deSerialize(char *&src) {
+  // map leaves the labels in src, see loadArray. nullptr if the labels run
+  // past end, see fitsImage.
+  static std::unique_ptr<LabelVector> deSerialize(char *&src,
+                                                  const bool map = false,
+                                                  const char *end = nullptr) {
     auto lv = std::make_unique<LabelVector>();
+    if (!fitsImage(src, end, sizeof(lv->num_bytes_))) return nullptr;
     memcpy(&(lv->num_bytes_), src, sizeof(lv->num_bytes_));
     src += sizeof(lv->num_bytes_);
-    lv->labels_ = const_cast<label_t *>(reinterpret_cast<const label_t *>(src));
+    if (!fitsImage(src, end, lv->num_bytes_)) return nullptr;
+    // the destructor releases labels_ unless mapped
+    lv->labels_ = loadArray<label_t>(src, lv->num_bytes_, map, lv->is_mapped_);
     src += lv->num_bytes_;
     align(src);
     return lv;
@@ -88,6 +112,8 @@ class LabelVector {
  private:
   position_t num_bytes_;
   label_t *labels_;
+  // labels_ points into a mapped image, see loadArray
+  bool is_mapped_ = false;
 };
 
 bool LabelVector::search(const label_t target, position_t &pos,
@@ -119,6 +145,20 @@ bool LabelVector::searchGreaterThan(const label_t target, position_t &pos,
     return binarySearchGreaterThan(target, pos, search_len);
 }
 
+bool LabelVector::searchLessThan(const label_t target, position_t &pos,
+                                 position_t search_len) const {
+  // skip terminator label
+  if ((search_len > 1) && (labels_[pos] == kTerminator)) {
+    pos++;
+    search_len--;
+  }
+
+  if (search_len < 3)
+    return linearSearchLessThan(target, pos, search_len);
+  else
+    return binarySearchLessThan(target, pos, search_len);
+}
+
 bool LabelVector::binarySearch(const label_t target, position_t &pos,
                                const position_t search_len) const {
   position_t l = pos;
@@ -220,6 +260,36 @@ bool LabelVector::linearSearchGreaterThan(const label_t target, position_t &pos,
   return false;
 }
 
+bool LabelVector::binarySearchLessThan(const label_t target, position_t &pos,
+                                       const position_t search_len) const {
+  position_t l = pos;
+  position_t r = pos + search_len;
+  while (l < r) {
+    position_t m = (l + r) >> 1;
+    if (labels_[m] < target)
+      l = m + 1;
+    else
+      r = m;
+  }
+
+  if (l > pos) {
+    pos = l - 1;
+    return true;
+  }
+  return false;
+}
+
+bool LabelVector::linearSearchLessThan(const label_t target, position_t &pos,
+                                       const position_t search_len) const {
+  for (position_t i = search_len; i > 0; i--) {
+    if (labels_[pos + i - 1] < target) {
+      pos += i - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace mmphf_fst
 
 #endif  // LABELVECTOR_H_
@@ -1,11 +1,14 @@
 #ifndef LOUDSDENSE_H_
 #define LOUDSDENSE_H_
 
+#include <algorithm>
 #include <string>
 
 #include "config.hpp"
 #include "fst_builder.hpp"
 #include "rank.hpp"
+#include "suffix.hpp"
+#include "value_vector.hpp"
 
 namespace mmphf_fst {
 
@@ -32,14 +35,11 @@ class LoudsDense {
           trie_(trie),
           send_out_node_num_(0),
           key_len_(0),
-          is_at_prefix_key_(false) {
-      for (level_t level = 0; level < trie_->getHeight(); level++) {
-        key_.push_back(0);
-        pos_in_trie_.push_back(0);
-        value_pos_.push_back(0);
-        value_pos_initialized_.push_back(false);
-      }
-    }
+          key_(trie_->getHeight(), 0),
+          pos_in_trie_(trie_->getHeight(), 0),
+          value_pos_(trie_->getHeight(), 0),
+          value_pos_initialized_(trie_->getHeight(), false),
+          is_at_prefix_key_(false) {}
 
     void clear();
 
@@ -76,10 +76,57 @@ class LoudsDense {
 
     void rankValuePosition(size_t pos);
 
+    // same as rankValuePosition for the key that ends at node_num
+    void rankPrefixKeyValuePosition(position_t node_num);
+
+    // index of the current leaf in value order
+    position_t getValuePos() const { return value_pos_[key_len_ - 1]; }
+
+    // number of key bytes up to and including the current leaf
+    level_t getPrefixLen() const { return key_len_; }
+
+    // position of the path's label at level
+    position_t getPosInTrie(level_t level) const { return pos_in_trie_[level]; }
+
+    bool isAtPrefixKey() const { return is_at_prefix_key_; }
+
     void operator++(int);
 
     void operator--(int);
 
+    // The level a forward seek to key (not smaller than the current key)
+    // resumes from: where key leaves the current path, or the current leaf's
+    // level if key extends its truncated key.
+    level_t getResumeLevel(const std::string &key) const;
+
+    // Drops the path from level on and forgets the value positions ranked
+    // there, leaves below may be skipped from here. Invalid until a seek
+    // repositions the iterator.
+    void resumeAt(level_t level);
+
+    // rankValuePosition counts forward from the value position of the
+    // previous leaf of a level; moving backwards invalidates them
+    void forgetValuePositions() {
+      std::fill(value_pos_initialized_.begin(), value_pos_initialized_.end(),
+                false);
+    }
+
+    // Appends the current path to token as its length, the prefix key flag
+    // and one label per level (see FST::Iter::saveToken)
+    void savePath(std::string &token) const;
+
+    // Restores a path written by savePath with one rank per level, no
+    // search. False if it does not fit the trie.
+    bool restorePath(const char *&src, const char *end);
+
+    // Without dense levels the whole key lives in LoudsSparse: marks the
+    // iterator valid and hands the sparse root over
+    void setToSparseRoot() {
+      key_len_ = 0;
+      setSendOutNodeNum(0);
+      setFlags(true, false, false, false);
+    }
+
    private:
     inline void append(position_t pos);
 
@@ -147,58 +194,205 @@ class LoudsDense {
 
   bool findNextNodeOrValue(const char keyByte, size_t &node_number) const;
 
-  // return value indicates potential false positive
+  // One level of an exact-match descent (see FST::seekBatch): appends the
+  // position of label in node_num to iter and moves node_num to its child.
+  // False if label is missing or a leaf. After the last dense level, iter
+  // hands the search over to LoudsSparse.
+  bool walkLabel(label_t label, position_t &node_num, Iter &iter) const;
+
+  // prefetches what walkLabel reads for label in node_num
+  void prefetchLabel(const position_t node_num, const label_t label) const {
+    label_bitmaps_->prefetch(node_num * kNodeFanout + label);
+    child_indicator_bitmaps_->prefetch(node_num * kNodeFanout + label);
+  }
+
+  // With use_keys == false, leaves are compared by their real suffix bits
+  // only. The iterator then stays at leaves that may hold a key smaller than
+  // searched_key (false positive) but never skips a greater one.
+  // start_level > 0 keeps iter's path above start_level, which must spell
+  // the first start_level bytes of searched_key (see Iter::getResumeLevel).
   void moveToKeyGreaterThan(const std::string &searched_key, bool inclusive,
-                            LoudsDense::Iter &iter) const;
+                            LoudsDense::Iter &iter, bool use_keys = true,
+                            level_t start_level = 0) const;
+
+  // Moves iter to the greatest key smaller than (or, if inclusive, equal
+  // to) searched_key in one descent. With use_keys == false a leaf that may
+  // equal searched_key is kept.
+  void moveToKeyLessThan(const std::string &searched_key, bool inclusive,
+                         LoudsDense::Iter &iter, bool use_keys = true) const;
+
+  const BitvectorSuffix &getSuffixes() const { return *suffixes_; }
 
   uint64_t getHeight() const { return height_; };
 
+  // see FST::setKeys
+  void setKeys(const std::vector<std::string> &keys) { keys_ = &keys; }
+
   uint64_t serializedSize() const;
 
   uint64_t getMemoryUsage() const;
 
-  void serialize(char *&dst) const {
-    memcpy(dst, &height_, sizeof(height_));
-    dst += sizeof(height_);
-    align(dst);
-    label_bitmaps_->serialize(dst);
-    child_indicator_bitmaps_->serialize(dst);
-    prefixkey_indicator_bits_->serialize(dst);
-    align(dst);
+  // appends a (value, position) pair for every leaf, in value order. Keys
+  // that end at a node go to prefix_keys, with the node's first position.
+  void getLeaves(std::vector<std::pair<uint64_t, position_t>> &leaves,
+                 std::vector<std::pair<uint64_t, position_t>> &prefix_keys)
+      const;
+
+  // index of the leaf at pos in value order, the prefix keys of this and
+  // all previous nodes come before it
+  position_t getValuePos(position_t pos) const {
+    return label_bitmaps_->rank(pos) - child_indicator_bitmaps_->rank(pos) +
+           prefixkey_indicator_bits_->rank(getNodeNum(pos)) - 1;
+  }
+
+  // whether a key ends at node_num, i.e., is a prefix of other keys
+  bool isPrefixKey(position_t node_num) const {
+    return prefixkey_indicator_bits_->readBit(node_num);
+  }
+
+  // index of the key that ends at node_num in value order, it precedes the
+  // leaves of the node
+  position_t getPrefixKeyValuePos(position_t node_num) const {
+    assert(isPrefixKey(node_num));
+    position_t pos = node_num * kNodeFanout;
+    position_t leaf_count =
+        pos == 0 ? 0
+                 : label_bitmaps_->rank(pos - 1) -
+                       child_indicator_bitmaps_->rank(pos - 1);
+    return leaf_count + prefixkey_indicator_bits_->rank(node_num) - 1;
   }
 
-  static std::unique_ptr<LoudsDense> deSerialize(char *&src) {
+  // Number of keys below node_num that precede its label at pos (a position
+  // in [first position of node_num, end of node_num]): the prefix key, the
+  // leaves and the keys below the child labels before pos. key_count_sums
+  // holds the prefix sums of the keys below each node, see
+  // FST::buildKeyCounts.
+  uint64_t countKeysBefore(position_t node_num, position_t pos,
+                           const std::vector<uint64_t> &key_count_sums) const;
+
+  // The label of node_num whose subtree holds the node's rank-th key, found
+  // by binary search over countKeysBefore. rank becomes the key's rank in
+  // that subtree. The prefix key (rank 0) is returned as in getNodeLabels.
+  NodeLabel findKeyLabel(position_t node_num, uint64_t &rank,
+                         const std::vector<uint64_t> &key_count_sums) const;
+
+  // label of node_num as a NodeLabel, false if the node does not have it;
+  // label_pos receives the label's position if not null
+  bool findLabel(position_t node_num, label_t label, NodeLabel &node_label,
+                 position_t *label_pos = nullptr) const {
+    position_t pos = node_num * kNodeFanout + label;
+    if (!label_bitmaps_->readBit(pos)) return false;
+    if (label_pos) *label_pos = pos;
+    if (child_indicator_bitmaps_->readBit(pos))
+      node_label = {label, true, getChildNodeNum(pos)};
+    else
+      node_label = {label, false, getValuePos(pos)};
+    return true;
+  }
+
+  // appends the labels of node_num in ascending order; label_set
+  // (kLabelSetWords words) restricts them if not null
+  void getNodeLabels(position_t node_num, std::vector<NodeLabel> &node_labels,
+                     const word_t *label_set = nullptr) const;
+
+  // the label bitmap of node_num (kLabelSetWords words), prefix key excluded
+  void getLabelSet(position_t node_num, word_t *label_set) const {
+    position_t word_id = node_num * kNodeFanout / kWordSize;
+    for (position_t word = 0; word < kLabelSetWords; word++)
+      label_set[word] = label_bitmaps_->getWord(word_id + word);
+  }
+
+  uint64_t getValue(position_t value_pos) const {
+    return positions_dense_->read(value_pos);
+  }
+
+  uint64_t getNumValues() const { return positions_dense_->numValues(); }
+
+  label_t getLabel(position_t pos) const { return pos % kNodeFanout; }
+
+  // number of the node that holds the label at pos
+  position_t getNodeNum(position_t pos) const { return pos / kNodeFanout; }
+
+  // position of the label that leads to node_num (node_num > 0)
+  position_t getParentPos(position_t node_num) const {
+    return child_indicator_bitmaps_->select(node_num);
+  }
+
+  // appends one entry per dense level, starting at the root
+  void getLevelStats(std::vector<LevelStats> &stats) const;
+
+  // appends (component name, bytes) pairs
+  void getMemoryBreakdown(
+      std::vector<std::pair<std::string, uint64_t>> &components) const;
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&height_, sizeof(height_));
+    out.align();
+    label_bitmaps_->serialize(out);
+    child_indicator_bitmaps_->serialize(out);
+    prefixkey_indicator_bits_->serialize(out);
+    suffixes_->serialize(out);
+    positions_dense_->serialize(out);
+  }
+
+  // nullptr if a component runs past end, see fitsImage
+  static std::unique_ptr<LoudsDense> deSerialize(char *&src,
+                                                 const char *end = nullptr) {
     std::unique_ptr<LoudsDense> louds_dense = std::make_unique<LoudsDense>();
+    if (!fitsImage(src, end, sizeof(louds_dense->height_))) return nullptr;
     memcpy(&(louds_dense->height_), src, sizeof(louds_dense->height_));
     src += sizeof(louds_dense->height_);
     align(src);
-    louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src);
-    louds_dense->child_indicator_bitmaps_ = BitvectorRank::deSerialize(src);
-    louds_dense->prefixkey_indicator_bits_ = BitvectorRank::deSerialize(src);
-    align(src);
+    louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src, false, end);
+    if (!louds_dense->label_bitmaps_) return nullptr;
+    louds_dense->child_indicator_bitmaps_ =
+        BitvectorRank::deSerialize(src, false, end);
+    if (!louds_dense->child_indicator_bitmaps_) return nullptr;
+    louds_dense->prefixkey_indicator_bits_ =
+        BitvectorRank::deSerialize(src, false, end);
+    if (!louds_dense->prefixkey_indicator_bits_) return nullptr;
+    louds_dense->suffixes_ = BitvectorSuffix::deSerialize(src, false, end);
+    if (!louds_dense->suffixes_) return nullptr;
+    louds_dense->positions_dense_ = ValueVector::deSerialize(src, false, end);
+    if (!louds_dense->positions_dense_) return nullptr;
+    // every level has a node, and every node a prefix key bit
+    if (louds_dense->height_ >
+        louds_dense->prefixkey_indicator_bits_->numBits())
+      return nullptr;
     return louds_dense;
   }
 
  private:
   position_t getChildNodeNum(position_t pos) const;
 
-  position_t getSuffixPos(position_t pos, bool is_prefix_key) const;
+  // position of the first label of node_num
+  position_t getFirstLabelPos(position_t node_num) const;
 
   position_t getNextPos(position_t pos) const;
 
   position_t getPrevPos(position_t pos, bool *is_out_of_bound) const;
 
+  // Orders the key stored at the iterator's current leaf relative to
+  // searched_key; both share the first prefix_len bytes. Exact with the
+  // original keys, otherwise 0 means "may be equal".
+  int compareLeafKey(const LoudsDense::Iter &iter,
+                     const std::string &searched_key, level_t prefix_len,
+                     bool use_keys) const;
+
  private:
   static const position_t kNodeFanout = 256;
   static const position_t kRankBasicBlockSize = 512;
 
-  std::vector<uint64_t> positions_dense_;
+  std::unique_ptr<ValueVector> positions_dense_;
 
   level_t height_{};
 
   std::unique_ptr<BitvectorRank> label_bitmaps_;
   std::unique_ptr<BitvectorRank> child_indicator_bitmaps_;
   std::unique_ptr<BitvectorRank> prefixkey_indicator_bits_;
+  // per leaf suffix bits, in the order of positions_dense_
+  std::unique_ptr<BitvectorSuffix> suffixes_;
   // const pointer to the original keys
   const std::vector<std::string> *keys_{};
 };
@@ -225,8 +419,10 @@ LoudsDense::LoudsDense(FSTBuilder *builder,
       kRankBasicBlockSize, builder->getPrefixkeyIndicatorBits(),
       builder->getNodeCounts(), 0, height_);
 
-  // todo make more efficient by completely moving this vector
-  positions_dense_ = builder->getDenseOffsets();
+  positions_dense_ = std::make_unique<ValueVector>(builder->getDenseOffsets());
+  suffixes_ = std::make_unique<BitvectorSuffix>(builder->getSuffixType(),
+                                                builder->getSuffixLen(),
+                                                builder->getDenseSuffixes());
 }
 
 bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
@@ -236,7 +432,9 @@ bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
   for (level_t level = 0; level < height_; level++) {
     pos = (node_num * kNodeFanout);
     if (level >= key.length()) {  // if run out of searchKey bytes
-      return false;
+      if (!isPrefixKey(node_num)) return false;
+      offset = positions_dense_->read(getPrefixKeyValuePos(node_num));
+      return true;
     }
     pos += (label_t)key[level];
 
@@ -247,10 +445,7 @@ bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
     }
 
     if (!child_indicator_bitmaps_->readBit(pos)) {  // if trie branch terminates
-      uint64_t value_index = label_bitmaps_->rank(pos) -
-                             child_indicator_bitmaps_->rank(pos) -
-                             1;  // + prefix but we do not support this so far
-      offset = positions_dense_[value_index];
+      offset = positions_dense_->read(getValuePos(pos));
 
       // the following check must be performed by the caller
       // return (*keys_)[value] == key;
@@ -270,7 +465,10 @@ inline bool LoudsDense::lookupKeyAtNode(const char *key, uint64_t key_length,
   for (; level < height_; level++) {
     pos = (node_num * kNodeFanout);
     if (level >= key_length) {  // if run out of searchKey bytes
-      return false;
+      if (!isPrefixKey(node_num)) return false;
+      value = positions_dense_->read(getPrefixKeyValuePos(node_num));
+      node_num = 0;
+      return true;
     }
     pos += (label_t)key[level];
 
@@ -279,10 +477,7 @@ inline bool LoudsDense::lookupKeyAtNode(const char *key, uint64_t key_length,
     }
 
     if (!child_indicator_bitmaps_->readBit(pos)) {  // if trie branch terminates
-      uint64_t value_index = label_bitmaps_->rank(pos) -
-                             child_indicator_bitmaps_->rank(pos) -
-                             1;  // + prefix but we do not support this so far
-      value = positions_dense_[value_index];
+      value = positions_dense_->read(getValuePos(pos));
 
       // the following check must be performed by the caller
       // return (*keys_)[value] == key;
@@ -329,9 +524,7 @@ void LoudsDense::getNode(size_t nodeNumber, std::vector<uint8_t> &labels,
         values.emplace_back(getChildNodeNum(pos + i) << 2U | 3U);
       } else {
         // there is a value, push it back and create an ART leaf node
-        uint64_t value_index = label_bitmaps_->rank(pos + i) -
-                               child_indicator_bitmaps_->rank(pos + i) - 1;
-        auto value = positions_dense_[value_index];
+        auto value = positions_dense_->read(getValuePos(pos + i));
         values.emplace_back((value << 2U) | 1U);
       }
     }
@@ -374,15 +567,13 @@ bool LoudsDense::lookupNodeNumber(const char *key, uint64_t key_length,
 //  - return false
 bool LoudsDense::findNextNodeOrValue(const char keyByte,
                                      size_t &node_number) const {
-  position_t pos = (node_number * kNodeFanout) + keyByte;
+  position_t pos = (node_number * kNodeFanout) + (label_t)keyByte;
   if (!label_bitmaps_->readBit(pos)) {  // key not immanent
     return false;
   }
   // key exists
   if (!child_indicator_bitmaps_->readBit(pos)) {  // branch terminates
-    uint64_t value_index =
-        label_bitmaps_->rank(pos) - child_indicator_bitmaps_->rank(pos) - 1;
-    node_number = (positions_dense_[value_index] << 2u) | 1u;
+    node_number = (positions_dense_->read(getValuePos(pos)) << 2u) | 1u;
   } else {  // branch continues
     node_number = (getChildNodeNum(pos) << 2u) | 3u;
   }
@@ -391,45 +582,53 @@ bool LoudsDense::findNextNodeOrValue(const char keyByte,
 
 void LoudsDense::moveToKeyGreaterThan(const std::string &searched_key,
                                       const bool inclusive,
-                                      LoudsDense::Iter &iter) const {
-  position_t node_num = 0;
+                                      LoudsDense::Iter &iter,
+                                      const bool use_keys,
+                                      const level_t start_level) const {
+  iter.resumeAt(start_level);
+  position_t node_num =
+      (start_level == 0) ? 0
+                         : getChildNodeNum(iter.pos_in_trie_[start_level - 1]);
   position_t pos = 0;
-  for (level_t level = 0; level < height_; level++) {
+  for (level_t level = start_level; level < height_; level++) {
     // if is_at_prefix_key_, pos is at the next valid position in the child node
     pos = node_num * kNodeFanout;
     if (level >= searched_key.length()) {  // if run out of searchKey bytes
-      // CA: key too short, -> dense (& sparse) traverse to leftmost key a
-      iter.append(getNextPos(pos - 1));
-      // if (prefixkey_indicator_bits_->readBit(node_num))  // if the prefix is
-      // also a key
-      //  iter.is_at_prefix_key_ = true;
-      // else
+      iter.append(getFirstLabelPos(node_num));
+      // the prefix key, if any, equals searched_key
+      if (inclusive && isPrefixKey(node_num)) {
+        iter.rankPrefixKeyValuePosition(node_num);
+        iter.is_at_prefix_key_ = true;
+        // valid, search complete, moveLeft complete, moveRight complete
+        iter.setFlags(true, true, true, true);
+        return;
+      }
+      // key too short, -> dense (& sparse) traverse to leftmost key
       iter.moveToLeftMostKey();
-      // valid, search complete, moveLeft complete, moveRight complete
-      // iter.setFlags(true, true, true, true);
       return;
     }
 
     pos += (label_t)searched_key[level];
     iter.append(pos);
 
-    // if no exact match
+    // if no exact match, continue at the next greater label (the search
+    // could continue in sparse levels)
     if (!label_bitmaps_->readBit(pos)) {
-      iter.moveToLeftMostKey();  // search could continue in sparse levels
+      iter++;
       return;
     }
 
     // if trie branch terminates
     if (!child_indicator_bitmaps_->readBit(pos)) {
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      int compare = compareLeafKey(iter, searched_key, level + 1, use_keys);
 
-      if (found_key > searched_key) {
+      if (compare > 0) {
         iter.setFlags(true, true, true, true);
-      } else if (found_key < searched_key) {
+      } else if (compare < 0) {
         iter++;  // no exact match, inclusive flag is not relevant
-      } else {   // found_key == searched_key
-        if (!inclusive)
+      } else {   // found_key == searched_key (or can not tell)
+        if (!inclusive && use_keys)
           iter++;
         else
           iter.setFlags(true, true, true, true);
@@ -447,10 +646,80 @@ void LoudsDense::moveToKeyGreaterThan(const std::string &searched_key,
   iter.setFlags(true, false, true, true);
 }
 
+void LoudsDense::moveToKeyLessThan(const std::string &searched_key,
+                                   const bool inclusive,
+                                   LoudsDense::Iter &iter,
+                                   const bool use_keys) const {
+  iter.resumeAt(0);
+  position_t node_num = 0;
+  for (level_t level = 0; level < height_; level++) {
+    if (level >= searched_key.length()) {  // if run out of searchKey bytes
+      // the prefix key, if any, equals searched_key, all other keys below
+      // this node are greater
+      if (inclusive && isPrefixKey(node_num)) {
+        iter.append(getFirstLabelPos(node_num));
+        iter.rankPrefixKeyValuePosition(node_num);
+        iter.is_at_prefix_key_ = true;
+        // valid, search complete, moveLeft complete, moveRight complete
+        iter.setFlags(true, true, true, true);
+        return;
+      }
+      // keys are not empty
+      if (level == 0) return;
+      iter--;
+      return;
+    }
+
+    position_t pos = node_num * kNodeFanout + (label_t)searched_key[level];
+    iter.append(pos);
+
+    // if no exact match, continue at the next smaller label (the search
+    // could continue in sparse levels)
+    if (!label_bitmaps_->readBit(pos)) {
+      iter--;
+      return;
+    }
+
+    // if trie branch terminates
+    if (!child_indicator_bitmaps_->readBit(pos)) {
+      iter.rankValuePosition(pos);
+      int compare = compareLeafKey(iter, searched_key, level + 1, use_keys);
+      if (compare < 0 || (compare == 0 && (inclusive || !use_keys)))
+        iter.setFlags(true, true, true, true);
+      else
+        iter--;
+      return;
+    }
+    node_num = getChildNodeNum(pos);
+  }
+
+  // search will continue in LoudsSparse
+  iter.setSendOutNodeNum(node_num);
+  // valid, search INCOMPLETE, moveLeft complete, moveRight complete
+  iter.setFlags(true, false, true, true);
+}
+
+bool LoudsDense::walkLabel(const label_t label, position_t &node_num,
+                           LoudsDense::Iter &iter) const {
+  position_t pos = node_num * kNodeFanout + label;
+  if (!label_bitmaps_->readBit(pos) || !child_indicator_bitmaps_->readBit(pos))
+    return false;
+  iter.append(pos);
+  node_num = getChildNodeNum(pos);
+  if (iter.key_len_ == height_) {
+    iter.setSendOutNodeNum(node_num);
+    // valid, search INCOMPLETE, moveLeft complete, moveRight complete
+    iter.setFlags(true, false, true, true);
+  }
+  return true;
+}
+
 uint64_t LoudsDense::serializedSize() const {
   uint64_t size = sizeof(height_) + label_bitmaps_->serializedSize() +
                   child_indicator_bitmaps_->serializedSize() +
-                  prefixkey_indicator_bits_->serializedSize();
+                  prefixkey_indicator_bits_->serializedSize() +
+                  suffixes_->serializedSize() +
+                  positions_dense_->serializedSize();
   sizeAlign(size);
   return size;
 }
@@ -458,23 +727,124 @@ uint64_t LoudsDense::serializedSize() const {
 uint64_t LoudsDense::getMemoryUsage() const {
   return (sizeof(LoudsDense) + label_bitmaps_->size() +
           child_indicator_bitmaps_->size() + prefixkey_indicator_bits_->size() +
-          positions_dense_.size() * 8);
+          suffixes_->size() + positions_dense_->size());
+}
+
+void LoudsDense::getNodeLabels(const position_t node_num,
+                               std::vector<NodeLabel> &node_labels,
+                               const word_t *label_set) const {
+  position_t pos = node_num * kNodeFanout;
+  if (isPrefixKey(node_num))
+    node_labels.push_back({0, false, getPrefixKeyValuePos(node_num), true});
+  // node bitmaps are word aligned
+  for (position_t word = 0; word < kLabelSetWords; word++) {
+    word_t bits = label_bitmaps_->getWord(pos / kWordSize + word);
+    if (label_set != nullptr) bits &= label_set[word];
+    while (bits != 0) {
+      position_t label = word * kWordSize + __builtin_clzll(bits);
+      bits &= ~(kMsbMask >> (label % kWordSize));
+      if (child_indicator_bitmaps_->readBit(pos + label))
+        node_labels.push_back(
+            {(label_t)label, true, getChildNodeNum(pos + label)});
+      else
+        node_labels.push_back(
+            {(label_t)label, false, getValuePos(pos + label)});
+    }
+  }
+}
+
+void LoudsDense::getLeaves(
+    std::vector<std::pair<uint64_t, position_t>> &leaves,
+    std::vector<std::pair<uint64_t, position_t>> &prefix_keys) const {
+  position_t value_pos = 0;
+  for (position_t pos = 0; pos < label_bitmaps_->numBits(); pos++) {
+    if (pos % kNodeFanout == 0 && isPrefixKey(getNodeNum(pos)))
+      prefix_keys.emplace_back(positions_dense_->read(value_pos++), pos);
+    if (label_bitmaps_->readBit(pos) && !child_indicator_bitmaps_->readBit(pos))
+      leaves.emplace_back(positions_dense_->read(value_pos++), pos);
+  }
+}
+
+uint64_t LoudsDense::countKeysBefore(
+    const position_t node_num, const position_t pos,
+    const std::vector<uint64_t> &key_count_sums) const {
+  position_t begin = node_num * kNodeFanout;
+  position_t labels = label_bitmaps_->countOnes(begin, pos);
+  position_t children = child_indicator_bitmaps_->countOnes(begin, pos);
+  // the children of node_num are numbered consecutively
+  position_t first_child = child_indicator_bitmaps_->countOnes(0, begin) + 1;
+  return isPrefixKey(node_num) + (labels - children) +
+         key_count_sums[first_child + children] - key_count_sums[first_child];
+}
+
+NodeLabel LoudsDense::findKeyLabel(
+    const position_t node_num, uint64_t &rank,
+    const std::vector<uint64_t> &key_count_sums) const {
+  if (rank == 0 && isPrefixKey(node_num))
+    return {0, false, getPrefixKeyValuePos(node_num), true};
+  // the last position with at most rank keys before it holds the label
+  position_t lo = node_num * kNodeFanout;
+  position_t hi = lo + kNodeFanout;
+  while (hi - lo > 1) {
+    position_t mid = lo + (hi - lo) / 2;
+    if (countKeysBefore(node_num, mid, key_count_sums) <= rank)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  rank -= countKeysBefore(node_num, lo, key_count_sums);
+  if (child_indicator_bitmaps_->readBit(lo))
+    return {getLabel(lo), true, getChildNodeNum(lo)};
+  return {getLabel(lo), false, getValuePos(lo)};
+}
+
+void LoudsDense::getLevelStats(std::vector<LevelStats> &stats) const {
+  // nodes of one level are numbered consecutively, the root is node 0
+  position_t first_node = 0;
+  position_t node_count = 1;
+  for (level_t level = 0; level < height_; level++) {
+    position_t begin = first_node * kNodeFanout;
+    position_t end = (first_node + node_count) * kNodeFanout;
+    uint64_t label_count = label_bitmaps_->countOnes(begin, end);
+    uint64_t child_count = child_indicator_bitmaps_->countOnes(begin, end);
+    uint64_t prefix_key_count = prefixkey_indicator_bits_->countOnes(
+        first_node, first_node + node_count);
+    stats.push_back({level, true, node_count, label_count, child_count,
+                     label_count - child_count + prefix_key_count});
+    first_node += node_count;
+    node_count = child_count;
+  }
+}
+
+void LoudsDense::getMemoryBreakdown(
+    std::vector<std::pair<std::string, uint64_t>> &components) const {
+  components.emplace_back("dense label bitmaps", label_bitmaps_->size());
+  components.emplace_back("dense child indicator bitmaps",
+                          child_indicator_bitmaps_->size());
+  components.emplace_back("dense prefix key indicator bits",
+                          prefixkey_indicator_bits_->size());
+  components.emplace_back("dense suffixes", suffixes_->size());
+  components.emplace_back("dense values", positions_dense_->size());
+}
+
+int LoudsDense::compareLeafKey(const LoudsDense::Iter &iter,
+                               const std::string &searched_key,
+                               const level_t prefix_len,
+                               const bool use_keys) const {
+  if (use_keys) {
+    int compare = (*keys_)[iter.getValue()].compare(searched_key);
+    return (compare > 0) - (compare < 0);
+  }
+  return suffixes_->compare(iter.getValuePos(), searched_key, prefix_len);
 }
 
 position_t LoudsDense::getChildNodeNum(const position_t pos) const {
   return child_indicator_bitmaps_->rank(pos);
 }
 
-position_t LoudsDense::getSuffixPos(const position_t pos,
-                                    const bool is_prefix_key) const {
-  position_t node_num = pos / kNodeFanout;
-  position_t suffix_pos =
-      (label_bitmaps_->rank(pos) - child_indicator_bitmaps_->rank(pos) +
-       prefixkey_indicator_bits_->rank(node_num) - 1);
-  if (is_prefix_key && label_bitmaps_->readBit(pos) &&
-      !child_indicator_bitmaps_->readBit(pos))
-    suffix_pos--;
-  return suffix_pos;
+position_t LoudsDense::getFirstLabelPos(const position_t node_num) const {
+  position_t pos = node_num * kNodeFanout;
+  return label_bitmaps_->readBit(pos) ? pos : getNextPos(pos);
 }
 
 position_t LoudsDense::getNextPos(const position_t pos) const {
@@ -484,7 +854,8 @@ position_t LoudsDense::getNextPos(const position_t pos) const {
 position_t LoudsDense::getPrevPos(const position_t pos,
                                   bool *is_out_of_bound) const {
   position_t distance = label_bitmaps_->distanceToPrevSetBit(pos);
-  if (pos <= distance) {
+  // distance is pos + 1 if no bit before pos is set
+  if (pos == 0 || pos < distance) {
     *is_out_of_bound = true;
     return 0;
   }
@@ -501,11 +872,12 @@ void LoudsDense::Iter::clear() {
 }
 
 int LoudsDense::Iter::compare(const std::string &key) const {
-  if (is_at_prefix_key_ && (key_len_ - 1) < key.length()) return -1;
   std::string iter_key = getKey();
   std::string key_dense = key.substr(0, iter_key.length());
   int compare = iter_key.compare(key_dense);
   if (compare != 0) return compare;
+  // a prefix key precedes the longer keys it is a prefix of
+  if (is_at_prefix_key_ && iter_key.length() < key.length()) return -1;
   return compare;
 }
 
@@ -570,14 +942,15 @@ void LoudsDense::Iter::moveToLeftMostKey() {
   while (level < trie_->getHeight() - 1) {
     position_t node_num = trie_->getChildNodeNum(pos);
     // if the current prefix is also a key
-    if (trie_->prefixkey_indicator_bits_->readBit(node_num)) {
-      append(trie_->getNextPos(node_num * kNodeFanout - 1));
+    if (trie_->isPrefixKey(node_num)) {
+      append(trie_->getFirstLabelPos(node_num));
+      rankPrefixKeyValuePosition(node_num);
       is_at_prefix_key_ = true;
       // valid, search complete, moveLeft complete, moveRight complete
       return setFlags(true, true, true, true);
     }
 
-    pos = trie_->getNextPos(node_num * kNodeFanout - 1);
+    pos = trie_->getFirstLabelPos(node_num);
     append(pos);
 
     // if trie branch terminates
@@ -596,11 +969,14 @@ void LoudsDense::Iter::moveToLeftMostKey() {
 
 void LoudsDense::Iter::moveToRightMostKey() {
   assert(key_len_ > 0);
+  forgetValuePositions();
   level_t level = key_len_ - 1;
   position_t pos = pos_in_trie_[level];
-  if (!trie_->child_indicator_bitmaps_->readBit(pos))
+  if (!trie_->child_indicator_bitmaps_->readBit(pos)) {
+    rankValuePosition(pos);
     // valid, search complete, moveLeft complete, moveRight complete
     return setFlags(true, true, true, true);
+  }
 
   while (level < trie_->getHeight() - 1) {
     position_t node_num = trie_->getChildNodeNum(pos);
@@ -613,9 +989,11 @@ void LoudsDense::Iter::moveToRightMostKey() {
     append(pos);
 
     // if trie branch terminates
-    if (!trie_->child_indicator_bitmaps_->readBit(pos))
+    if (!trie_->child_indicator_bitmaps_->readBit(pos)) {
+      rankValuePosition(pos);
       // valid, search complete, moveLeft complete, moveRight complete
       return setFlags(true, true, true, true);
+    }
 
     level++;
   }
@@ -629,7 +1007,7 @@ uint64_t LoudsDense::Iter::getLastIteratorPosition() const {
 }
 
 uint64_t LoudsDense::Iter::getValue() const {
-  return trie_->positions_dense_[value_pos_[key_len_ - 1]];
+  return trie_->positions_dense_->read(value_pos_[key_len_ - 1]);
 }
 
 void LoudsDense::Iter::rankValuePosition(size_t pos) {
@@ -637,15 +1015,21 @@ void LoudsDense::Iter::rankValuePosition(size_t pos) {
     value_pos_[key_len_ - 1]++;
   } else {  // initially rank value position here
     value_pos_initialized_[key_len_ - 1] = true;
-    uint64_t value_index = trie_->label_bitmaps_->rank(pos) -
-                           trie_->child_indicator_bitmaps_->rank(pos) -
-                           1;  // + prefix but we do not support this so far
-    value_pos_[key_len_ - 1] = value_index;
+    value_pos_[key_len_ - 1] = trie_->getValuePos(pos);
   }
 }
 
+void LoudsDense::Iter::rankPrefixKeyValuePosition(position_t node_num) {
+  // the prefix key directly precedes the next leaf of its level
+  value_pos_initialized_[key_len_ - 1] = true;
+  value_pos_[key_len_ - 1] = trie_->getPrefixKeyValuePos(node_num);
+}
+
 void LoudsDense::Iter::operator++(int) {
-  assert(key_len_ > 0);
+  if (key_len_ == 0) {  // no dense levels, nothing left to visit
+    is_valid_ = false;
+    return;
+  }
   if (is_at_prefix_key_) {
     is_at_prefix_key_ = false;
     return moveToLeftMostKey();
@@ -666,8 +1050,84 @@ void LoudsDense::Iter::operator++(int) {
   return moveToLeftMostKey();
 }
 
+level_t LoudsDense::Iter::getResumeLevel(const std::string &key) const {
+  level_t len = is_at_prefix_key_ ? key_len_ - 1 : key_len_;
+  level_t level = 0;
+  while (level < len && level < key.length() &&
+         key_[level] == (label_t)key[level])
+    level++;
+  if (level == len && level > 0 && isComplete() && !is_at_prefix_key_)
+    level--;
+  return level;
+}
+
+void LoudsDense::Iter::resumeAt(const level_t level) {
+  assert(level <= key_len_);
+  is_valid_ = false;
+  key_len_ = level;
+  is_at_prefix_key_ = false;
+  for (level_t i = level; i < value_pos_initialized_.size(); i++)
+    value_pos_initialized_[i] = false;
+}
+
+void LoudsDense::Iter::savePath(std::string &token) const {
+  appendVarint(token, ((uint64_t)key_len_ << 1) | is_at_prefix_key_);
+  token.append((const char *)key_.data(), key_len_);
+}
+
+bool LoudsDense::Iter::restorePath(const char *&src, const char *end) {
+  uint64_t header;
+  if (!readVarint(src, end, header)) return false;
+  uint64_t key_len = header >> 1;
+  bool is_at_prefix_key = header & 1;
+  if (key_len > key_.size() || key_len > (uint64_t)(end - src)) return false;
+  clear();
+  forgetValuePositions();
+  if (key_len == 0) {
+    if (trie_->getHeight() > 0) return false;
+    setToSparseRoot();
+    return true;
+  }
+
+  position_t node_num = 0;
+  for (level_t level = 0; level < key_len; level++) {
+    if (level > 0) {
+      if (!trie_->child_indicator_bitmaps_->readBit(pos_in_trie_[level - 1]))
+        return false;
+      node_num = trie_->getChildNodeNum(pos_in_trie_[level - 1]);
+    }
+    position_t pos = node_num * kNodeFanout + (label_t)src[level];
+    if (!trie_->label_bitmaps_->readBit(pos)) return false;
+    append(pos);
+  }
+  src += key_len;
+
+  position_t pos = pos_in_trie_[key_len_ - 1];
+  if (is_at_prefix_key) {
+    if (!trie_->isPrefixKey(node_num) ||
+        pos != trie_->getFirstLabelPos(node_num))
+      return false;
+    rankPrefixKeyValuePosition(node_num);
+    is_at_prefix_key_ = true;
+  } else if (!trie_->child_indicator_bitmaps_->readBit(pos)) {
+    rankValuePosition(pos);
+  } else {  // the leaf lives in LoudsSparse
+    if (key_len_ != trie_->getHeight()) return false;
+    send_out_node_num_ = trie_->getChildNodeNum(pos);
+    // valid, search complete, moveLeft INCOMPLETE, moveRight complete
+    setFlags(true, true, false, true);
+    return true;
+  }
+  // valid, search complete, moveLeft complete, moveRight complete
+  setFlags(true, true, true, true);
+  return true;
+}
+
 void LoudsDense::Iter::operator--(int) {
-  assert(key_len_ > 0);
+  if (key_len_ == 0) {  // no dense levels, nothing left to visit
+    is_valid_ = false;
+    return;
+  }
   if (is_at_prefix_key_) {
     is_at_prefix_key_ = false;
     key_len_--;
@@ -685,6 +1145,10 @@ void LoudsDense::Iter::operator--(int) {
     // if the current prefix is also a key
     position_t node_num = pos / kNodeFanout;
     if (trie_->prefixkey_indicator_bits_->readBit(node_num)) {
+      // pos may be a missing label that moveToKeyLessThan stopped at
+      set(key_len_ - 1, trie_->getFirstLabelPos(node_num));
+      forgetValuePositions();
+      rankPrefixKeyValuePosition(node_num);
       is_at_prefix_key_ = true;
       // valid, search complete, moveLeft complete, moveRight complete
       return setFlags(true, true, true, true);
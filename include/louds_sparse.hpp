@@ -1,6 +1,7 @@
 #ifndef LOUDSSPARSE_H_
 #define LOUDSSPARSE_H_
 
+#include <algorithm>
 #include <string>
 
 #include "config.hpp"
@@ -8,6 +9,8 @@
 #include "label_vector.hpp"
 #include "rank.hpp"
 #include "select.hpp"
+#include "suffix.hpp"
+#include "value_vector.hpp"
 
 namespace mmphf_fst {
 
@@ -28,14 +31,14 @@ class LoudsSparse {
           trie_(trie),
           start_node_num_(0),
           key_len_(0),
+          key_(std::max(trie->getHeight(), trie->getStartLevel()) -
+                   trie->getStartLevel(),
+               0),
+          pos_in_trie_(key_.size(), 0),
+          value_pos_(key_.size(), 0),
+          value_pos_initialized_(key_.size(), false),
           is_at_terminator_(false) {
       start_level_ = trie_->getStartLevel();
-      for (level_t level = start_level_; level < trie_->getHeight(); level++) {
-        key_.push_back(0);
-        pos_in_trie_.push_back(0);
-        value_pos_.push_back(0);
-        value_pos_initialized_.push_back(false);
-      }
     }
 
     void clear();
@@ -64,10 +67,39 @@ class LoudsSparse {
 
     void rankValuePosition(size_t pos);
 
+    // index of the current leaf in value order
+    position_t getValuePos() const { return value_pos_[key_len_ - 1]; }
+
+    // number of key bytes (from level 0) up to and including the current leaf
+    level_t getPrefixLen() const { return start_level_ + key_len_; }
+
+    // position of the path's label at level, counted from start_level_
+    position_t getPosInTrie(level_t level) const { return pos_in_trie_[level]; }
+
     void operator++(int);
 
     void operator--(int);
 
+    // see LoudsDense::Iter, levels count from level 0
+    level_t getResumeLevel(const std::string &key) const;
+
+    void resumeAt(level_t level);
+
+    // see LoudsDense::Iter::forgetValuePositions
+    void forgetValuePositions() {
+      std::fill(value_pos_initialized_.begin(), value_pos_initialized_.end(),
+                false);
+    }
+
+    // Appends the current path to token as its length and the offset of
+    // each level's label in its node (see FST::Iter::saveToken)
+    void savePath(std::string &token) const;
+
+    // Restores a path written by savePath below getStartNodeNum() with a
+    // rank and two selects per level, no search. False if it does not fit
+    // the trie.
+    bool restorePath(const char *&src, const char *end);
+
    private:
     void append(position_t pos);
 
@@ -112,6 +144,22 @@ class LoudsSparse {
 
   bool findNextNodeOrValue(const char keyByte, size_t &node_number) const;
 
+  // see LoudsDense::walkLabel
+  bool walkLabel(label_t label, position_t &node_num, Iter &iter) const;
+
+  // The two dependent steps of walkLabel: prefetchNode fetches the select
+  // sample of node_num, prefetchLabels (after it) the labels and child bits
+  // of node_num.
+  void prefetchNode(const position_t node_num) const {
+    louds_bits_->prefetch(node_num + 1 - node_count_dense_);
+  }
+
+  void prefetchLabels(const position_t node_num) const {
+    position_t pos = getFirstLabelPos(node_num);
+    labels_->prefetch(pos);
+    child_indicator_bits_->prefetch(pos);
+  }
+
   bool nodeHasMultipleBranchesOrTerminates(
       size_t &nodeNumber, std::vector<uint8_t> &prefixLabels) const;
 
@@ -120,35 +168,141 @@ class LoudsSparse {
 
   void lookupNodeNumber(uint64_t key_length, position_t &out_node_num) const;
 
+  // see LoudsDense::moveToKeyGreaterThan for use_keys and start_level, which
+  // counts from level 0 here
   void moveToKeyGreaterThan(const std::string &searched_key, bool inclusive,
-                            LoudsSparse::Iter &iter) const;
+                            LoudsSparse::Iter &iter, bool use_keys = true,
+                            level_t start_level = 0) const;
+
+  // see LoudsDense::moveToKeyLessThan
+  void moveToKeyLessThan(const std::string &searched_key, bool inclusive,
+                         LoudsSparse::Iter &iter, bool use_keys = true) const;
+
+  const BitvectorSuffix &getSuffixes() const { return *suffixes_; }
 
   level_t getHeight() const { return height_; };
 
   level_t getStartLevel() const { return start_level_; };
 
+  // see FST::setKeys
+  void setKeys(const std::vector<std::string> &keys) { keys_ = &keys; }
+
+  // the attached original keys, nullptr if there are none
+  const std::vector<std::string> *getKeys() const { return keys_; }
+
   uint64_t serializedSize() const;
 
   uint64_t getMemoryUsage() const;
 
-  void serialize(char *&dst) const {
-    memcpy(dst, &height_, sizeof(height_));
-    dst += sizeof(height_);
-    memcpy(dst, &start_level_, sizeof(start_level_));
-    dst += sizeof(start_level_);
-    memcpy(dst, &node_count_dense_, sizeof(node_count_dense_));
-    dst += sizeof(node_count_dense_);
-    memcpy(dst, &child_count_dense_, sizeof(child_count_dense_));
-    dst += sizeof(child_count_dense_);
-    align(dst);
-    labels_->serialize(dst);
-    child_indicator_bits_->serialize(dst);
-    louds_bits_->serialize(dst);
-    align(dst);
-  }
-
-  static std::unique_ptr<LoudsSparse> deSerialize(char *&src) {
+  // appends a (value, position) pair for every leaf, in value order. Keys
+  // that end at a node (terminator labels) go to prefix_keys instead.
+  void getLeaves(std::vector<std::pair<uint64_t, position_t>> &leaves,
+                 std::vector<std::pair<uint64_t, position_t>> &prefix_keys)
+      const;
+
+  // index of the leaf at pos in value order
+  position_t getValuePos(position_t pos) const {
+    return pos - child_indicator_bits_->rank(pos);
+  }
+
+  // see LoudsDense::findLabel
+  bool findLabel(position_t node_num, label_t label, NodeLabel &node_label,
+                 position_t *label_pos = nullptr) const {
+    position_t pos = getFirstLabelPos(node_num);
+    if (!labels_->search(label, pos, nodeSize(pos))) return false;
+    if (label_pos) *label_pos = pos;
+    if (child_indicator_bits_->readBit(pos))
+      node_label = {label, true, getChildNodeNum(pos)};
+    else
+      node_label = {label, false, getValuePos(pos)};
+    return true;
+  }
+
+  // see LoudsDense::getNodeLabels
+  void getNodeLabels(position_t node_num, std::vector<NodeLabel> &node_labels,
+                     const word_t *label_set = nullptr) const;
+
+  // see LoudsDense::getLabelSet
+  void getLabelSet(position_t node_num, word_t *label_set) const;
+
+  uint64_t getValue(position_t value_pos) const {
+    return positions_sparse_->read(value_pos);
+  }
+
+  // see LoudsDense::isPrefixKey
+  bool isPrefixKey(position_t node_num) const {
+    return isTerminator(getFirstLabelPos(node_num));
+  }
+
+  position_t getPrefixKeyValuePos(position_t node_num) const {
+    assert(isPrefixKey(node_num));
+    return getValuePos(getFirstLabelPos(node_num));
+  }
+
+  // see LoudsDense::countKeysBefore, a prefix key is the terminator label
+  uint64_t countKeysBefore(position_t node_num, position_t pos,
+                           const std::vector<uint64_t> &key_count_sums) const;
+
+  // see LoudsDense::findKeyLabel
+  NodeLabel findKeyLabel(position_t node_num, uint64_t &rank,
+                         const std::vector<uint64_t> &key_count_sums) const;
+
+  uint64_t getNumValues() const { return positions_sparse_->numValues(); }
+
+  // nodes below getNodeCountDense() are dense nodes
+  position_t getNodeCountDense() const { return node_count_dense_; }
+
+  // number of dense and sparse nodes
+  position_t getNodeCount() const {
+    return node_count_dense_ + louds_bits_->numOnes();
+  }
+
+  label_t getLabel(position_t pos) const { return labels_->read(pos); }
+
+  // number of the node that holds the label at pos
+  position_t getNodeNum(position_t pos) const {
+    return louds_bits_->rank(pos) - 1 + node_count_dense_;
+  }
+
+  // Nodes 1..getChildCountDense() are children of dense labels
+  position_t getChildCountDense() const { return child_count_dense_; }
+
+  // position of the sparse label that leads to node_num
+  // (node_num > getChildCountDense())
+  position_t getParentPos(position_t node_num) const {
+    return child_indicator_bits_->select(node_num - child_count_dense_);
+  }
+
+  // appends one entry per sparse level, starting at start_level_
+  void getLevelStats(std::vector<LevelStats> &stats) const;
+
+  // appends (component name, bytes) pairs
+  void getMemoryBreakdown(
+      std::vector<std::pair<std::string, uint64_t>> &components) const;
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&height_, sizeof(height_));
+    out.write(&start_level_, sizeof(start_level_));
+    out.write(&node_count_dense_, sizeof(node_count_dense_));
+    out.write(&child_count_dense_, sizeof(child_count_dense_));
+    out.align();
+    labels_->serialize(out);
+    child_indicator_bits_->serialize(out);
+    louds_bits_->serialize(out);
+    suffixes_->serialize(out);
+    positions_sparse_->serialize(out);
+  }
+
+  // map leaves the labels, child indicator and LOUDS bits, suffixes and
+  // values in src (e.g., a MappedFile), which must outlive the trie; see
+  // loadArray. nullptr if a component runs past end, see fitsImage.
+  static std::unique_ptr<LoudsSparse> deSerialize(char *&src,
+                                                  const bool map = false,
+                                                  const char *end = nullptr) {
     std::unique_ptr<LoudsSparse> louds_sparse = std::make_unique<LoudsSparse>();
+    if (!fitsImage(src, end, 2 * sizeof(level_t) + 2 * sizeof(position_t)))
+      return nullptr;
     memcpy(&(louds_sparse->height_), src, sizeof(louds_sparse->height_));
     src += sizeof(louds_sparse->height_);
     memcpy(&(louds_sparse->start_level_), src,
@@ -161,10 +315,28 @@ class LoudsSparse {
            sizeof(louds_sparse->child_count_dense_));
     src += sizeof(louds_sparse->child_count_dense_);
     align(src);
-    louds_sparse->labels_ = LabelVector::deSerialize(src);
-    louds_sparse->child_indicator_bits_ = BitvectorRank::deSerialize(src);
-    louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src);
-    align(src);
+    louds_sparse->labels_ = LabelVector::deSerialize(src, map, end);
+    if (!louds_sparse->labels_) return nullptr;
+    louds_sparse->child_indicator_bits_ =
+        BitvectorRank::deSerialize(src, map, end);
+    if (!louds_sparse->child_indicator_bits_) return nullptr;
+    louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src, map, end);
+    if (!louds_sparse->louds_bits_) return nullptr;
+    louds_sparse->suffixes_ = BitvectorSuffix::deSerialize(src, map, end);
+    if (!louds_sparse->suffixes_) return nullptr;
+    louds_sparse->positions_sparse_ = ValueVector::deSerialize(src, map, end);
+    if (!louds_sparse->positions_sparse_) return nullptr;
+    // one bit per label in each bitvector; the label vector has one byte of
+    // padding
+    position_t num_labels = louds_sparse->labels_->getNumBytes() - 1;
+    if (louds_sparse->labels_->getNumBytes() == 0 ||
+        louds_sparse->child_indicator_bits_->numBits() != num_labels ||
+        louds_sparse->louds_bits_->numBits() != num_labels)
+      return nullptr;
+    // every sparse level has a label
+    if (louds_sparse->start_level_ > louds_sparse->height_ ||
+        louds_sparse->height_ - louds_sparse->start_level_ > num_labels)
+      return nullptr;
     return louds_sparse;
   }
 
@@ -181,17 +353,32 @@ class LoudsSparse {
 
   bool isEndofNode(position_t pos) const;
 
+  // a prefix key's terminator is the first of at least two labels, a real
+  // 0xFF label the last
+  bool isTerminator(position_t pos) const {
+    return labels_->read(pos) == kTerminator &&
+           !child_indicator_bits_->readBit(pos) && !isEndofNode(pos);
+  }
+
   void moveToLeftInNextSubtrie(position_t pos, position_t node_size,
                                label_t label, LoudsSparse::Iter &iter) const;
 
+  void moveToRightInPrevSubtrie(position_t pos, position_t node_size,
+                                label_t label, LoudsSparse::Iter &iter) const;
+
   // return value indicates potential false positive
   bool compareSuffixGreaterThan(LoudsSparse::Iter &iter) const;
 
+  // see LoudsDense::compareLeafKey
+  int compareLeafKey(const LoudsSparse::Iter &iter,
+                     const std::string &searched_key, level_t prefix_len,
+                     bool use_keys) const;
+
  private:
   static const position_t kRankBasicBlockSize = 512;
   static const position_t kSelectSampleInterval = 64;
 
-  std::vector<uint64_t> positions_sparse_;
+  std::unique_ptr<ValueVector> positions_sparse_;
 
   level_t height_;       // trie height
   level_t start_level_;  // louds-sparse encoding starts at this level
@@ -203,8 +390,10 @@ class LoudsSparse {
   std::unique_ptr<LabelVector> labels_;
   std::unique_ptr<BitvectorRank> child_indicator_bits_;
   std::unique_ptr<BitvectorSelect> louds_bits_;
+  // per leaf suffix bits, in the order of positions_sparse_
+  std::unique_ptr<BitvectorSuffix> suffixes_;
   // pointer to the original data
-  const std::vector<std::string> *keys_;
+  const std::vector<std::string> *keys_{};
 };
 
 const position_t LoudsSparse::kRankBasicBlockSize;
@@ -222,9 +411,11 @@ LoudsSparse::LoudsSparse(const FSTBuilder *builder,
   }
   if (start_level_ == 0) {
     child_count_dense_ = 0;
-  } else {
+  } else if (start_level_ < height_) {
     child_count_dense_ =
         node_count_dense_ + builder->getNodeCounts()[start_level_] - 1;
+  } else {  // all levels are dense
+    child_count_dense_ = node_count_dense_ - 1;
   }
   labels_ = std::make_unique<LabelVector>(builder->getLabels(), start_level_,
                                           height_);
@@ -240,7 +431,11 @@ LoudsSparse::LoudsSparse(const FSTBuilder *builder,
       kSelectSampleInterval, builder->getLoudsBits(), num_items_per_level,
       start_level_, height_);
 
-  positions_sparse_ = builder->getSparseOffsets();
+  positions_sparse_ =
+      std::make_unique<ValueVector>(builder->getSparseOffsets());
+  suffixes_ = std::make_unique<BitvectorSuffix>(builder->getSuffixType(),
+                                                builder->getSuffixLen(),
+                                                builder->getSparseSuffixes());
 }
 
 bool LoudsSparse::lookupKey(const std::string &key,
@@ -256,7 +451,7 @@ bool LoudsSparse::lookupKey(const std::string &key,
     // if trie branch terminates
     if (!child_indicator_bits_->readBit(pos)) {
       uint64_t value_pos = pos - child_indicator_bits_->rank(pos);
-      offset = positions_sparse_[value_pos];
+      offset = positions_sparse_->read(value_pos);
       // this check must be performed from the caller
       // return (*keys_)[value] == key;
       return true;
@@ -266,7 +461,10 @@ bool LoudsSparse::lookupKey(const std::string &key,
     node_num = getChildNodeNum(pos);
     pos = getFirstLabelPos(node_num);
   }
-  return false;
+  // key ends at this node
+  if (!isTerminator(pos)) return false;
+  offset = positions_sparse_->read(getValuePos(pos));
+  return true;
 }
 
 inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length,
@@ -282,7 +480,7 @@ inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length,
     // if trie branch terminates
     if (!child_indicator_bits_->readBit(pos)) {
       uint64_t value_pos = pos - child_indicator_bits_->rank(pos);
-      offset = positions_sparse_[value_pos];
+      offset = positions_sparse_->read(value_pos);
       // this check must be performed from the caller
       // return (*keys_)[value] == key;
       return true;
@@ -292,7 +490,10 @@ inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length,
     node_num = getChildNodeNum(pos);
     pos = getFirstLabelPos(node_num);
   }
-  return false;
+  // key ends at this node
+  if (!isTerminator(pos)) return false;
+  offset = positions_sparse_->read(getValuePos(pos));
+  return true;
 }
 
 // returns true if next node or value is found, false if keyByte is not immanent
@@ -312,7 +513,7 @@ bool LoudsSparse::findNextNodeOrValue(const char keyByte,
   // find next node or value
   if (!child_indicator_bits_->readBit(pos)) {  // branch terminates
     uint64_t value_pos = pos - child_indicator_bits_->rank(pos);
-    uint64_t offset = positions_sparse_[value_pos];
+    uint64_t offset = positions_sparse_->read(value_pos);
     node_num = (offset << 2u) | 1u;
   } else {  // branch continues
     node_num = (getChildNodeNum(pos) << 2u) | 3u;
@@ -331,7 +532,7 @@ void LoudsSparse::getNode(size_t nodeNumber, std::vector<uint8_t> &labels,
       values.emplace_back(childNodeNum << 2U | 3U);
     } else {  // leads to a value
       uint64_t value_pos = i - child_indicator_bits_->rank(i);
-      auto offset = positions_sparse_[value_pos];
+      auto offset = positions_sparse_->read(value_pos);
       values.emplace_back(offset << 2U | 1U);
     }
   }
@@ -370,31 +571,38 @@ void LoudsSparse::lookupNodeNumber(uint64_t key_length,
 
 void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
                                        const bool inclusive,
-                                       LoudsSparse::Iter &iter) const {
-  position_t node_num = iter.getStartNodeNum();
+                                       LoudsSparse::Iter &iter,
+                                       const bool use_keys,
+                                       const level_t start_level) const {
+  level_t level = std::max(start_level, start_level_);
+  iter.resumeAt(level);
+  position_t node_num =
+      (iter.key_len_ == 0)
+          ? iter.getStartNodeNum()
+          : getChildNodeNum(iter.pos_in_trie_[iter.key_len_ - 1]);
   position_t pos = getFirstLabelPos(node_num);
 
-  level_t level;
-  for (level = start_level_; level < searched_key.length(); level++) {
+  for (; level < searched_key.length(); level++) {
+    position_t node_pos = pos;
     position_t node_size = nodeSize(pos);
-    // if no exact match
+    // if no exact match (the search may have moved pos past a terminator)
     if (!labels_->search((label_t)searched_key[level], pos, node_size)) {
       // do not return false, but just move to the next bigger key?
-      moveToLeftInNextSubtrie(pos, node_size, searched_key[level], iter);
+      moveToLeftInNextSubtrie(node_pos, node_size, searched_key[level], iter);
       return;
     }
     iter.append(searched_key[level], pos);
 
     if (!child_indicator_bits_->readBit(pos)) {  // / trie branch terminates
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      int compare = compareLeafKey(iter, searched_key, level + 1, use_keys);
 
-      if (found_key > searched_key) {
+      if (compare > 0) {
         iter.is_valid_ = true;
-      } else if (found_key < searched_key) {
+      } else if (compare < 0) {
         iter++;
-      } else {  // found_key == searched_key
-        if (!inclusive)
+      } else {  // found_key == searched_key (or can not tell)
+        if (!inclusive && use_keys)
           iter++;
         else
           iter.is_valid_ = true;
@@ -406,9 +614,9 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
     pos = getFirstLabelPos(node_num);
   }
 
-  if ((labels_->read(pos) == kTerminator) &&
-      (!child_indicator_bits_->readBit(pos)) && !isEndofNode(pos)) {
+  if (isTerminator(pos)) {
     iter.append(kTerminator, pos);
+    iter.rankValuePosition(pos);
     iter.is_at_terminator_ = true;
     if (!inclusive) iter++;
     iter.is_valid_ = true;
@@ -424,18 +632,188 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
   iter.is_valid_ = true;
 }
 
+void LoudsSparse::moveToKeyLessThan(const std::string &searched_key,
+                                    const bool inclusive,
+                                    LoudsSparse::Iter &iter,
+                                    const bool use_keys) const {
+  iter.resumeAt(start_level_);
+  position_t pos = getFirstLabelPos(iter.getStartNodeNum());
+
+  for (level_t level = start_level_; level < searched_key.length(); level++) {
+    position_t node_pos = pos;
+    position_t node_size = nodeSize(pos);
+    if (!labels_->search((label_t)searched_key[level], pos, node_size)) {
+      moveToRightInPrevSubtrie(node_pos, node_size, searched_key[level], iter);
+      return;
+    }
+    iter.append(searched_key[level], pos);
+
+    if (!child_indicator_bits_->readBit(pos)) {  // trie branch terminates
+      iter.rankValuePosition(pos);
+      int compare = compareLeafKey(iter, searched_key, level + 1, use_keys);
+      if (compare < 0 || (compare == 0 && (inclusive || !use_keys)))
+        iter.is_valid_ = true;
+      else
+        iter--;
+      return;
+    }
+    // move to child
+    pos = getFirstLabelPos(getChildNodeNum(pos));
+  }
+
+  // the terminator, if any, equals searched_key, all other keys below this
+  // node are greater
+  if (inclusive && isTerminator(pos)) {
+    iter.append(kTerminator, pos);
+    iter.rankValuePosition(pos);
+    iter.is_at_terminator_ = true;
+    iter.is_valid_ = true;
+    return;
+  }
+  if (iter.key_len_ == 0) return;
+  iter--;
+}
+
+bool LoudsSparse::walkLabel(const label_t label, position_t &node_num,
+                            LoudsSparse::Iter &iter) const {
+  position_t pos = getFirstLabelPos(node_num);
+  if (!labels_->search(label, pos, nodeSize(pos)) ||
+      !child_indicator_bits_->readBit(pos))
+    return false;
+  iter.append(label, pos);
+  node_num = getChildNodeNum(pos);
+  return true;
+}
+
 uint64_t LoudsSparse::serializedSize() const {
   uint64_t size =
       sizeof(height_) + sizeof(start_level_) + sizeof(node_count_dense_) +
       sizeof(child_count_dense_) + labels_->serializedSize() +
-      child_indicator_bits_->serializedSize() + louds_bits_->serializedSize();
+      child_indicator_bits_->serializedSize() + louds_bits_->serializedSize() +
+      suffixes_->serializedSize() + positions_sparse_->serializedSize();
   sizeAlign(size);
   return size;
 }
 
 uint64_t LoudsSparse::getMemoryUsage() const {
   return (sizeof(*this) + labels_->size() + child_indicator_bits_->size() +
-          louds_bits_->size() + positions_sparse_.size() * 8);
+          louds_bits_->size() + suffixes_->size() + positions_sparse_->size());
+}
+
+void LoudsSparse::getNodeLabels(const position_t node_num,
+                                std::vector<NodeLabel> &node_labels,
+                                const word_t *label_set) const {
+  position_t pos = getFirstLabelPos(node_num);
+  position_t node_size = nodeSize(pos);
+  for (position_t i = pos; i < pos + node_size; i++) {
+    label_t label = labels_->read(i);
+    if (i == pos && isTerminator(i)) {
+      node_labels.push_back({0, false, getValuePos(i), true});
+      continue;
+    }
+    if (label_set != nullptr &&
+        !(label_set[label / kWordSize] & (kMsbMask >> (label % kWordSize))))
+      continue;
+    if (child_indicator_bits_->readBit(i))
+      node_labels.push_back({label, true, getChildNodeNum(i)});
+    else
+      node_labels.push_back({label, false, getValuePos(i)});
+  }
+}
+
+uint64_t LoudsSparse::countKeysBefore(
+    const position_t node_num, const position_t pos,
+    const std::vector<uint64_t> &key_count_sums) const {
+  position_t begin = getFirstLabelPos(node_num);
+  position_t children = child_indicator_bits_->countOnes(begin, pos);
+  // see LoudsDense::countKeysBefore
+  position_t first_child =
+      child_count_dense_ + child_indicator_bits_->countOnes(0, begin) + 1;
+  return (pos - begin - children) + key_count_sums[first_child + children] -
+         key_count_sums[first_child];
+}
+
+NodeLabel LoudsSparse::findKeyLabel(
+    const position_t node_num, uint64_t &rank,
+    const std::vector<uint64_t> &key_count_sums) const {
+  position_t lo = getFirstLabelPos(node_num);
+  position_t hi = getLastLabelPos(node_num) + 1;
+  while (hi - lo > 1) {
+    position_t mid = lo + (hi - lo) / 2;
+    if (countKeysBefore(node_num, mid, key_count_sums) <= rank)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  rank -= countKeysBefore(node_num, lo, key_count_sums);
+  if (isTerminator(lo)) return {0, false, getValuePos(lo), true};
+  if (child_indicator_bits_->readBit(lo))
+    return {getLabel(lo), true, getChildNodeNum(lo)};
+  return {getLabel(lo), false, getValuePos(lo)};
+}
+
+void LoudsSparse::getLabelSet(const position_t node_num,
+                              word_t *label_set) const {
+  std::fill(label_set, label_set + kLabelSetWords, 0);
+  position_t pos = getFirstLabelPos(node_num);
+  position_t node_size = nodeSize(pos);
+  for (position_t i = pos; i < pos + node_size; i++) {
+    if (i == pos && isTerminator(i)) continue;
+    label_t label = labels_->read(i);
+    label_set[label / kWordSize] |= kMsbMask >> (label % kWordSize);
+  }
+}
+
+void LoudsSparse::getLeaves(
+    std::vector<std::pair<uint64_t, position_t>> &leaves,
+    std::vector<std::pair<uint64_t, position_t>> &prefix_keys) const {
+  position_t value_pos = 0;
+  for (position_t pos = 0; pos < child_indicator_bits_->numBits(); pos++) {
+    if (child_indicator_bits_->readBit(pos)) continue;
+    auto &target = isTerminator(pos) ? prefix_keys : leaves;
+    target.emplace_back(positions_sparse_->read(value_pos++), pos);
+  }
+}
+
+void LoudsSparse::getLevelStats(std::vector<LevelStats> &stats) const {
+  // nodes of one level are numbered consecutively; the first sparse node
+  // directly follows the last dense node
+  position_t first_node = node_count_dense_;
+  position_t node_count =
+      start_level_ == 0 ? 1 : child_count_dense_ - node_count_dense_ + 1;
+  for (level_t level = start_level_; level < height_; level++) {
+    if (node_count == 0) break;
+    position_t begin = getFirstLabelPos(first_node);
+    position_t end = louds_bits_->numBits();
+    if (first_node + node_count - node_count_dense_ < louds_bits_->numOnes())
+      end = getFirstLabelPos(first_node + node_count);
+    uint64_t child_count = child_indicator_bits_->countOnes(begin, end);
+    stats.push_back({level, false, node_count, end - begin, child_count,
+                     end - begin - child_count});
+    first_node += node_count;
+    node_count = child_count;
+  }
+}
+
+void LoudsSparse::getMemoryBreakdown(
+    std::vector<std::pair<std::string, uint64_t>> &components) const {
+  components.emplace_back("sparse labels", labels_->size());
+  components.emplace_back("sparse child indicator bits",
+                          child_indicator_bits_->size());
+  components.emplace_back("sparse louds bits", louds_bits_->size());
+  components.emplace_back("sparse suffixes", suffixes_->size());
+  components.emplace_back("sparse values", positions_sparse_->size());
+}
+
+int LoudsSparse::compareLeafKey(const LoudsSparse::Iter &iter,
+                                const std::string &searched_key,
+                                const level_t prefix_len,
+                                const bool use_keys) const {
+  if (use_keys) {
+    int compare = (*keys_)[iter.getValue()].compare(searched_key);
+    return (compare > 0) - (compare < 0);
+  }
+  return suffixes_->compare(iter.getValuePos(), searched_key, prefix_len);
 }
 
 position_t LoudsSparse::getChildNodeNum(const position_t pos) const {
@@ -469,9 +847,11 @@ void LoudsSparse::moveToLeftInNextSubtrie(position_t pos,
                                           const position_t node_size,
                                           const label_t label,
                                           LoudsSparse::Iter &iter) const {
-  // if no label is greater than key[level] in this node
+  position_t last_pos = pos + node_size - 1;
+  // if no label is greater than key[level] in this node (the search skips a
+  // terminator and moves pos)
   if (!labels_->searchGreaterThan(label, pos, node_size)) {
-    iter.append(pos + node_size - 1);
+    iter.append(last_pos);
     return iter++;
   } else {
     iter.append(pos);
@@ -479,6 +859,22 @@ void LoudsSparse::moveToLeftInNextSubtrie(position_t pos,
   }
 }
 
+void LoudsSparse::moveToRightInPrevSubtrie(const position_t pos,
+                                           const position_t node_size,
+                                           const label_t label,
+                                           LoudsSparse::Iter &iter) const {
+  position_t prev_pos = pos;
+  // if no label is smaller than key[level] in this node, the node's
+  // terminator (a smaller key) or the previous subtrie holds the result
+  if (!labels_->searchLessThan(label, prev_pos, node_size)) {
+    iter.append(pos);
+    if (isTerminator(pos)) return iter.moveToRightMostKey();
+    return iter--;
+  }
+  iter.append(prev_pos);
+  return iter.moveToRightMostKey();
+}
+
 bool LoudsSparse::compareSuffixGreaterThan(LoudsSparse::Iter &iter) const {
   // position_t suffix_pos = getSuffixPos(pos);
   // int compare = suffixes_->compare(suffix_pos, key, level);
@@ -499,13 +895,13 @@ void LoudsSparse::Iter::clear() {
 }
 
 int LoudsSparse::Iter::compare(const std::string &key) const {
-  if (is_at_terminator_ && (key_len_ - 1) < (key.length() - start_level_))
-    return -1;
   std::string iter_key = getKey();
   std::string key_sparse = key.substr(start_level_);
   std::string key_sparse_same_length = key_sparse.substr(0, iter_key.length());
   int compare = iter_key.compare(key_sparse_same_length);
   if (compare != 0) return compare;
+  // see LoudsDense::Iter::compare
+  if (is_at_terminator_ && iter_key.length() < key_sparse.length()) return -1;
   return compare;
 }
 
@@ -560,8 +956,7 @@ void LoudsSparse::Iter::moveToLeftMostKey() {
   label_t label = trie_->labels_->read(pos);
 
   if (!trie_->child_indicator_bits_->readBit(pos)) {
-    if ((label == kTerminator) && !trie_->isEndofNode(pos))
-      is_at_terminator_ = true;
+    if (trie_->isTerminator(pos)) is_at_terminator_ = true;
     is_valid_ = true;
     rankValuePosition(pos);
     return;
@@ -574,8 +969,7 @@ void LoudsSparse::Iter::moveToLeftMostKey() {
     // if trie branch terminates
     if (!trie_->child_indicator_bits_->readBit(pos)) {
       append(label, pos);
-      if ((label == kTerminator) && !trie_->isEndofNode(pos))
-        is_at_terminator_ = true;
+      if (trie_->isTerminator(pos)) is_at_terminator_ = true;
       rankValuePosition(pos);
       is_valid_ = true;
       return;
@@ -587,6 +981,7 @@ void LoudsSparse::Iter::moveToLeftMostKey() {
 }
 
 void LoudsSparse::Iter::moveToRightMostKey() {
+  forgetValuePositions();
   if (key_len_ == 0) {
     // todo can we remove the following statement since it has no effect?
     trie_->getFirstLabelPos(start_node_num_);
@@ -600,9 +995,9 @@ void LoudsSparse::Iter::moveToRightMostKey() {
   label_t label = trie_->labels_->read(pos);
 
   if (!trie_->child_indicator_bits_->readBit(pos)) {
-    if ((label == kTerminator) && !trie_->isEndofNode(pos))
-      is_at_terminator_ = true;
+    if (trie_->isTerminator(pos)) is_at_terminator_ = true;
     is_valid_ = true;
+    rankValuePosition(pos);
     return;
   }
 
@@ -613,8 +1008,8 @@ void LoudsSparse::Iter::moveToRightMostKey() {
     // if trie branch terminates
     if (!trie_->child_indicator_bits_->readBit(pos)) {
       append(label, pos);
-      if ((label == kTerminator) && !trie_->isEndofNode(pos))
-        is_at_terminator_ = true;
+      if (trie_->isTerminator(pos)) is_at_terminator_ = true;
+      rankValuePosition(pos);
       is_valid_ = true;
       return;
     }
@@ -625,7 +1020,7 @@ void LoudsSparse::Iter::moveToRightMostKey() {
 }
 
 uint64_t LoudsSparse::Iter::getValue() const {
-  return trie_->positions_sparse_[value_pos_[key_len_ - 1]];
+  return trie_->positions_sparse_->read(value_pos_[key_len_ - 1]);
 }
 
 uint64_t LoudsSparse::Iter::getLastIteratorPosition() const {
@@ -663,14 +1058,73 @@ void LoudsSparse::Iter::operator++(int) {
   return moveToLeftMostKey();
 }
 
+level_t LoudsSparse::Iter::getResumeLevel(const std::string &key) const {
+  level_t len = is_at_terminator_ ? key_len_ - 1 : key_len_;
+  level_t level = 0;
+  while (level < len && start_level_ + level < key.length() &&
+         key_[level] == (label_t)key[start_level_ + level])
+    level++;
+  if (level == len && !is_at_terminator_) level--;
+  return start_level_ + level;
+}
+
+void LoudsSparse::Iter::resumeAt(const level_t level) {
+  assert(level >= start_level_ && level - start_level_ <= key_len_);
+  is_valid_ = false;
+  key_len_ = level - start_level_;
+  is_at_terminator_ = false;
+  for (level_t i = key_len_; i < value_pos_initialized_.size(); i++)
+    value_pos_initialized_[i] = false;
+}
+
+void LoudsSparse::Iter::savePath(std::string &token) const {
+  appendVarint(token, key_len_);
+  position_t node_num = start_node_num_;
+  for (level_t level = 0; level < key_len_; level++) {
+    if (level > 0) node_num = trie_->getChildNodeNum(pos_in_trie_[level - 1]);
+    appendVarint(token,
+                 pos_in_trie_[level] - trie_->getFirstLabelPos(node_num));
+  }
+}
+
+bool LoudsSparse::Iter::restorePath(const char *&src, const char *end) {
+  uint64_t key_len;
+  if (!readVarint(src, end, key_len)) return false;
+  if (key_len == 0 || key_len > key_.size()) return false;
+  clear();
+  forgetValuePositions();
+  if (start_node_num_ < trie_->node_count_dense_ ||
+      start_node_num_ >= trie_->getNodeCount())
+    return false;
+
+  position_t node_num = start_node_num_;
+  for (level_t level = 0; level < key_len; level++) {
+    if (level > 0) {
+      if (!trie_->child_indicator_bits_->readBit(pos_in_trie_[level - 1]))
+        return false;
+      node_num = trie_->getChildNodeNum(pos_in_trie_[level - 1]);
+    }
+    uint64_t offset;
+    if (!readVarint(src, end, offset)) return false;
+    position_t first_pos = trie_->getFirstLabelPos(node_num);
+    if (offset > trie_->getLastLabelPos(node_num) - first_pos) return false;
+    append((position_t)(first_pos + offset));
+  }
+
+  position_t pos = pos_in_trie_[key_len_ - 1];
+  if (trie_->child_indicator_bits_->readBit(pos)) return false;
+  is_at_terminator_ = trie_->isTerminator(pos);
+  rankValuePosition(pos);
+  is_valid_ = true;
+  return true;
+}
+
 void LoudsSparse::Iter::operator--(int) {
   assert(key_len_ > 0);
+  forgetValuePositions();
   is_at_terminator_ = false;
   position_t pos = pos_in_trie_[key_len_ - 1];
-  if (pos == 0) {
-    is_valid_ = false;
-    return;
-  }
+  // the first label of a node has its louds bit set, this includes pos 0
   while (trie_->louds_bits_->readBit(pos)) {
     key_len_--;
     if (key_len_ == 0) {
@@ -0,0 +1,57 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+namespace mmphf_fst {
+
+// A read-only memory mapping of a whole file, e.g., a serialized FST that
+// does not fit in memory. Pages are read on first access and evicted by the
+// kernel under memory pressure, so the page cache acts as the buffer pool.
+class MappedFile {
+ public:
+  // nullptr if the file can not be opened or mapped. random_access disables
+  // read-ahead, so a lookup that faults reads only the pages it touches.
+  static std::unique_ptr<MappedFile> open(const std::string &path,
+                                          const bool random_access = true) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return nullptr;
+    }
+    // private and read-only: the FST never writes to its image
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    if (random_access) madvise(data, st.st_size, MADV_RANDOM);
+    return std::unique_ptr<MappedFile>(
+        new MappedFile((char *)data, (uint64_t)st.st_size));
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { munmap(data_, size_); }
+
+  char *data() const { return data_; }
+
+  uint64_t size() const { return size_; }
+
+ private:
+  MappedFile(char *data, const uint64_t size) : data_(data), size_(size) {}
+
+  char *data_;
+  uint64_t size_;
+};
+
+}  // namespace mmphf_fst
+
+#endif  // MAPPEDFILE_H_
@@ -1,6 +1,7 @@
 #ifndef RANK_H_
 #define RANK_H_
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <stdexcept>
@@ -27,7 +28,7 @@ class BitvectorRank : public Bitvector {
   }
 
   ~BitvectorRank() {
-    delete[] bits_;
+    if (!is_mapped_) delete[] bits_;
     delete[] rank_lut_;
   }
 
@@ -43,6 +44,33 @@ class BitvectorRank : public Bitvector {
             popcountLinear(bits_, block_id * word_per_basic_block, offset + 1));
   }
 
+  // Counts the number of 1's in the range [begin, end)
+  position_t countOnes(position_t begin, position_t end) const {
+    if (begin >= end) return 0;
+    return rank(end - 1) - (begin == 0 ? 0 : rank(begin - 1));
+  }
+
+  // Returns the position of the rank-th 1 bit (the inverse of rank).
+  // rank is one-based. Binary searches the rank look-up table.
+  position_t select(position_t rank) const {
+    assert(rank > 0);
+    position_t num_blocks = num_bits_ / basic_block_size_ + 1;
+    // the last block preceded by fewer than rank 1 bits holds the result
+    position_t block_id =
+        std::upper_bound(rank_lut_, rank_lut_ + num_blocks, rank - 1) -
+        rank_lut_ - 1;
+    position_t rank_left = rank - rank_lut_[block_id];
+    position_t word_id = block_id * (basic_block_size_ / kWordSize);
+    position_t ones_count_in_word = popcount(bits_[word_id]);
+    while (ones_count_in_word < rank_left) {
+      rank_left -= ones_count_in_word;
+      word_id++;
+      ones_count_in_word = popcount(bits_[word_id]);
+    }
+    return (word_id * kWordSize +
+            select64_popcount_search(bits_[word_id], rank_left));
+  }
+
   position_t rankLutSize() const {
     return ((num_bits_ / basic_block_size_ + 1) * sizeof(position_t));
   }
@@ -54,8 +82,10 @@ class BitvectorRank : public Bitvector {
     return size;
   }
 
+  // in-memory bytes, mapped bits excluded
   position_t size() const override {
-    return (sizeof(BitvectorRank) + bitsSize() + rankLutSize());
+    return sizeof(BitvectorRank) + (is_mapped_ ? 0 : bitsSize()) +
+           rankLutSize();
   }
 
   void prefetch(position_t pos) const {
@@ -63,30 +93,43 @@ class BitvectorRank : public Bitvector {
     __builtin_prefetch(rank_lut_ + (pos / basic_block_size_));
   }
 
-  void serialize(char *&dst) const {
-    memcpy(dst, &num_bits_, sizeof(num_bits_));
-    dst += sizeof(num_bits_);
-    memcpy(dst, &basic_block_size_, sizeof(basic_block_size_));
-    dst += sizeof(basic_block_size_);
-    memcpy(dst, bits_, bitsSize());
-    dst += bitsSize();
-    memcpy(dst, rank_lut_, rankLutSize());
-    dst += rankLutSize();
-    align(dst);
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&num_bits_, sizeof(num_bits_));
+    out.write(&basic_block_size_, sizeof(basic_block_size_));
+    out.write(bits_, bitsSize());
+    out.write(rank_lut_, rankLutSize());
+    out.align();
   }
 
-  static std::unique_ptr<BitvectorRank> deSerialize(char *&src) {
+  // map leaves the bits in src, see loadArray; the rank directory is copied.
+  // nullptr if the bitvector runs past end, see fitsImage.
+  static std::unique_ptr<BitvectorRank> deSerialize(char *&src,
+                                                    const bool map = false,
+                                                    const char *end = nullptr) {
     auto bv_rank = std::make_unique<BitvectorRank>();
+    if (!fitsImage(src, end,
+                   sizeof(bv_rank->num_bits_) +
+                       sizeof(bv_rank->basic_block_size_)))
+      return nullptr;
     memcpy(&(bv_rank->num_bits_), src, sizeof(bv_rank->num_bits_));
     src += sizeof(bv_rank->num_bits_);
     memcpy(&(bv_rank->basic_block_size_), src,
            sizeof(bv_rank->basic_block_size_));
     src += sizeof(bv_rank->basic_block_size_);
-    bv_rank->bits_ =
-        const_cast<word_t *>(reinterpret_cast<const word_t *>(src));
+    // a basic block is a whole number of words
+    if (bv_rank->basic_block_size_ == 0 ||
+        bv_rank->basic_block_size_ % kWordSize != 0 ||
+        !fitsImage(src, end,
+                   (uint64_t)bv_rank->bitsSize() + bv_rank->rankLutSize()))
+      return nullptr;
+    // the destructor releases rank_lut_ and bits_ unless mapped
+    bv_rank->bits_ = loadArray<word_t>(src, bv_rank->bitsSize(), map,
+                                       bv_rank->is_mapped_);
     src += bv_rank->bitsSize();
     bv_rank->rank_lut_ =
-        const_cast<position_t *>(reinterpret_cast<const position_t *>(src));
+        new position_t[bv_rank->rankLutSize() / sizeof(position_t)];
+    memcpy(bv_rank->rank_lut_, src, bv_rank->rankLutSize());
     src += bv_rank->rankLutSize();
     align(src);
     return bv_rank;
@@ -1,6 +1,7 @@
 #ifndef SELECT_H_
 #define SELECT_H_
 
+#include <algorithm>
 #include <cassert>
 #include <vector>
 
@@ -26,7 +27,7 @@ class BitvectorSelect : public Bitvector {
   }
 
   ~BitvectorSelect() {
-    delete[] bits_;
+    if (!is_mapped_) delete[] bits_;
     delete[] select_lut_;
   };
 
@@ -66,39 +67,65 @@ class BitvectorSelect : public Bitvector {
     return (word_id * kWordSize + select64_popcount_search(word, rank_left));
   }
 
+  // Counts the number of 1's up to position pos (the inverse of select).
+  // pos is zero-based; count is one-based. Starts from the closest sample of
+  // the select look-up table.
+  position_t rank(position_t pos) const {
+    assert(pos < num_bits_);
+    position_t num_samples = num_ones_ / sample_interval_ + 1;
+    position_t lut_idx =
+        std::upper_bound(select_lut_, select_lut_ + num_samples, pos) -
+        select_lut_ - 1;
+    position_t sample_pos = select_lut_[lut_idx];
+    position_t rank = (lut_idx == 0) ? 1 : lut_idx * sample_interval_;
+    // add the 1's in (sample_pos, pos]
+    position_t word_id = sample_pos / kWordSize;
+    return (rank +
+            popcountLinear(bits_, word_id, pos - word_id * kWordSize + 1) -
+            popcountLinear(bits_, word_id, sample_pos % kWordSize + 1));
+  }
+
+  // prefetches the sample select(rank) starts from
+  void prefetch(position_t rank) const {
+    __builtin_prefetch(select_lut_ + rank / sample_interval_);
+  }
+
   position_t selectLutSize() const {
     return ((num_ones_ / sample_interval_ + 1) * sizeof(position_t));
   }
 
   position_t serializedSize() const {
-    position_t size = sizeof(num_bits_) + sizeof(sample_interval_) +
-                      sizeof(num_ones_) + bitsSize() + selectLutSize();
+    position_t size = headerSize() + bitsSize() + selectLutSize();
     sizeAlign(size);
     return size;
   }
 
+  // in-memory bytes, mapped bits excluded
   position_t size() const override {
-    return (sizeof(BitvectorSelect) + bitsSize() + selectLutSize());
+    return sizeof(BitvectorSelect) + (is_mapped_ ? 0 : bitsSize()) +
+           selectLutSize();
   }
 
   position_t numOnes() const { return num_ones_; }
 
-  void serialize(char *&dst) const {
-    memcpy(dst, &num_bits_, sizeof(num_bits_));
-    dst += sizeof(num_bits_);
-    memcpy(dst, &sample_interval_, sizeof(sample_interval_));
-    dst += sizeof(sample_interval_);
-    memcpy(dst, &num_ones_, sizeof(num_ones_));
-    dst += sizeof(num_ones_);
-    memcpy(dst, bits_, bitsSize());
-    dst += bitsSize();
-    memcpy(dst, select_lut_, selectLutSize());
-    dst += selectLutSize();
-    align(dst);
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&num_bits_, sizeof(num_bits_));
+    out.write(&sample_interval_, sizeof(sample_interval_));
+    out.write(&num_ones_, sizeof(num_ones_));
+    // word align the bits, so that a mapped image can be read in place
+    out.align();
+    out.write(bits_, bitsSize());
+    out.write(select_lut_, selectLutSize());
+    out.align();
   }
 
-  static std::unique_ptr<BitvectorSelect> deSerialize(char *&src) {
+  // map leaves the bits in src, see loadArray; the select samples are
+  // copied. nullptr if the bitvector runs past end, see fitsImage.
+  static std::unique_ptr<BitvectorSelect> deSerialize(
+      char *&src, const bool map = false, const char *end = nullptr) {
     auto bv_select = std::make_unique<BitvectorSelect>();
+    if (!fitsImage(src, end, headerSize())) return nullptr;
     memcpy(&(bv_select->num_bits_), src, sizeof(bv_select->num_bits_));
     src += sizeof(bv_select->num_bits_);
     memcpy(&(bv_select->sample_interval_), src,
@@ -106,17 +133,33 @@ class BitvectorSelect : public Bitvector {
     src += sizeof(bv_select->sample_interval_);
     memcpy(&(bv_select->num_ones_), src, sizeof(bv_select->num_ones_));
     src += sizeof(bv_select->num_ones_);
-    bv_select->bits_ =
-        const_cast<word_t *>(reinterpret_cast<const word_t *>(src));
+    align(src);
+    if (bv_select->sample_interval_ == 0 ||
+        bv_select->num_ones_ > bv_select->num_bits_ ||
+        !fitsImage(src, end,
+                   (uint64_t)bv_select->bitsSize() +
+                       bv_select->selectLutSize()))
+      return nullptr;
+    // the destructor releases select_lut_ and bits_ unless mapped
+    bv_select->bits_ = loadArray<word_t>(src, bv_select->bitsSize(), map,
+                                         bv_select->is_mapped_);
     src += bv_select->bitsSize();
     bv_select->select_lut_ =
-        const_cast<position_t *>(reinterpret_cast<const position_t *>(src));
+        new position_t[bv_select->selectLutSize() / sizeof(position_t)];
+    memcpy(bv_select->select_lut_, src, bv_select->selectLutSize());
     src += bv_select->selectLutSize();
     align(src);
     return bv_select;
   }
 
  private:
+  // num_bits_, sample_interval_ and num_ones_, padded to a word
+  static position_t headerSize() {
+    position_t size = 3 * sizeof(position_t);
+    sizeAlign(size);
+    return size;
+  }
+
   // This function currently assumes that the first bit in the
   // bitvector is one.
   void initSelectLut() {
@@ -0,0 +1,183 @@
+#ifndef SUFFIX_H_
+#define SUFFIX_H_
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "hash.hpp"
+
+namespace mmphf_fst {
+
+// Fixed width suffixes, one per leaf in value order, bit-packed into words.
+// kHash stores hash bits of the whole key (equality checks only), kReal stores
+// the key bits that follow the truncated trie path (equality and ordering).
+class BitvectorSuffix {
+ public:
+  BitvectorSuffix()
+      : type_(kNone), suffix_len_(0), num_suffixes_(0), bits_(nullptr){};
+
+  BitvectorSuffix(const SuffixType type, const level_t suffix_len,
+                  const std::vector<uint64_t> &suffixes)
+      : type_(type), suffix_len_(suffix_len), bits_(nullptr) {
+    assert(suffix_len_ <= kWordSize);
+    if (type_ == kNone || suffix_len_ == 0) {
+      type_ = kNone;
+      suffix_len_ = 0;
+    }
+    num_suffixes_ = (type_ == kNone) ? 0 : suffixes.size();
+    bits_ = new word_t[numWords()]();
+    for (position_t idx = 0; idx < num_suffixes_; idx++)
+      write(idx, suffixes[idx]);
+  }
+
+  ~BitvectorSuffix() {
+    if (!is_mapped_) delete[] bits_;
+  }
+
+  // Builds the suffix of key, whose first prefix_len bytes are stored as the
+  // trie path. Real suffixes are zero padded past the end of the key.
+  static uint64_t constructSuffix(const SuffixType type,
+                                  const level_t suffix_len,
+                                  const std::string &key,
+                                  const level_t prefix_len) {
+    if (type == kHash) {
+      uint64_t hash = suffixHash(key);
+      return suffix_len >= 32 ? hash : (hash & ((1ull << suffix_len) - 1));
+    }
+    if (type != kReal || suffix_len == 0) return 0;
+    uint64_t suffix = 0;
+    for (level_t i = 0; i < kWordSize / 8; i++) {
+      label_t byte = (prefix_len + i < key.length())
+                         ? (label_t)key[prefix_len + i]
+                         : (label_t)0;
+      suffix = (suffix << 8u) | byte;
+    }
+    return suffix >> (kWordSize - suffix_len);
+  }
+
+  SuffixType getType() const { return type_; }
+
+  level_t getSuffixLen() const { return suffix_len_; }
+
+  uint64_t read(const position_t idx) const {
+    assert(idx < num_suffixes_);
+    uint64_t bit_pos = (uint64_t)idx * suffix_len_;
+    position_t word_id = bit_pos / kWordSize;
+    position_t offset = bit_pos % kWordSize;
+    word_t first = bits_[word_id] << offset;
+    if (offset + suffix_len_ <= kWordSize)
+      return first >> (kWordSize - suffix_len_);
+    word_t rest = bits_[word_id + 1] >> (kWordSize - offset);
+    return (first | rest) >> (kWordSize - suffix_len_);
+  }
+
+  // false means the key stored at idx is definitely not key
+  bool checkEquality(const position_t idx, const std::string &key,
+                     const level_t prefix_len) const {
+    if (type_ == kNone) return true;
+    return read(idx) == constructSuffix(type_, suffix_len_, key, prefix_len);
+  }
+
+  // Orders the key stored at idx relative to key (both share the first
+  // prefix_len bytes). 0 means the suffix bits can not tell.
+  int compare(const position_t idx, const std::string &key,
+              const level_t prefix_len) const {
+    if (type_ != kReal) return 0;
+    uint64_t stored = read(idx);
+    uint64_t searched = constructSuffix(type_, suffix_len_, key, prefix_len);
+    if (stored < searched) return -1;
+    if (stored > searched) return 1;
+    return 0;
+  }
+
+  position_t numWords() const {
+    return (position_t)(((uint64_t)num_suffixes_ * suffix_len_ + kWordSize -
+                         1) /
+                        kWordSize);
+  }
+
+  // in bytes
+  position_t bitsSize() const { return numWords() * (kWordSize / 8); }
+
+  // in-memory bytes, mapped bits excluded
+  position_t size() const {
+    return sizeof(BitvectorSuffix) + (is_mapped_ ? 0 : bitsSize());
+  }
+
+  position_t serializedSize() const {
+    position_t size = headerSize() + bitsSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&type_, sizeof(type_));
+    out.write(&suffix_len_, sizeof(suffix_len_));
+    out.write(&num_suffixes_, sizeof(num_suffixes_));
+    // word align the bits, so that a mapped image can be read in place
+    out.align();
+    out.write(bits_, bitsSize());
+    out.align();
+  }
+
+  // map leaves the bits in src, see loadArray. nullptr if the suffixes run
+  // past end (see fitsImage) or their type or width is not one FST builds.
+  static std::unique_ptr<BitvectorSuffix> deSerialize(
+      char *&src, const bool map = false, const char *end = nullptr) {
+    auto suffixes = std::make_unique<BitvectorSuffix>();
+    if (!fitsImage(src, end, headerSize())) return nullptr;
+    memcpy(&(suffixes->type_), src, sizeof(suffixes->type_));
+    src += sizeof(suffixes->type_);
+    memcpy(&(suffixes->suffix_len_), src, sizeof(suffixes->suffix_len_));
+    src += sizeof(suffixes->suffix_len_);
+    memcpy(&(suffixes->num_suffixes_), src, sizeof(suffixes->num_suffixes_));
+    src += sizeof(suffixes->num_suffixes_);
+    align(src);
+    // kNone, and only kNone, stores no bits per suffix
+    if (suffixes->type_ < kNone || suffixes->type_ > kReal ||
+        suffixes->suffix_len_ > kWordSize ||
+        (suffixes->type_ == kNone) != (suffixes->suffix_len_ == 0) ||
+        !fitsImage(src, end, suffixes->numWords(), kWordSize / 8))
+      return nullptr;
+    suffixes->bits_ = loadArray<word_t>(src, suffixes->bitsSize(), map,
+                                        suffixes->is_mapped_);
+    src += suffixes->bitsSize();
+    align(src);
+    return suffixes;
+  }
+
+ private:
+  // type_, suffix_len_ and num_suffixes_, padded to a word
+  static position_t headerSize() {
+    position_t size =
+        sizeof(SuffixType) + sizeof(level_t) + sizeof(position_t);
+    sizeAlign(size);
+    return size;
+  }
+
+  void write(const position_t idx, const uint64_t suffix) {
+    uint64_t bit_pos = (uint64_t)idx * suffix_len_;
+    position_t word_id = bit_pos / kWordSize;
+    position_t offset = bit_pos % kWordSize;
+    // left align the suffix, then split it over (at most) two words
+    word_t aligned = suffix << (kWordSize - suffix_len_);
+    bits_[word_id] |= aligned >> offset;
+    if (offset + suffix_len_ > kWordSize)
+      bits_[word_id + 1] |= aligned << (kWordSize - offset);
+  }
+
+  SuffixType type_;
+  level_t suffix_len_;
+  position_t num_suffixes_;
+  word_t *bits_;
+  // bits_ points into a mapped image, see loadArray
+  bool is_mapped_ = false;
+};
+
+}  // namespace mmphf_fst
+
+#endif  // SUFFIX_H_
@@ -0,0 +1,123 @@
+#ifndef VALUEVECTOR_H_
+#define VALUEVECTOR_H_
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include "config.hpp"
+
+namespace mmphf_fst {
+
+// The values of the leaves in leaf order, bit-packed into words with a fixed
+// width: the bit length of the largest value. Key positions take
+// ceil(log2(#keys)) bits each, 4 byte payloads at most 32.
+class ValueVector {
+ public:
+  ValueVector() : width_(0), num_values_(0), bits_(nullptr) {}
+
+  explicit ValueVector(const std::vector<uint64_t> &values)
+      : width_(0), num_values_(values.size()), bits_(nullptr) {
+    uint64_t max_value = 0;
+    for (uint64_t value : values) max_value |= value;
+    if (max_value != 0) width_ = kWordSize - __builtin_clzll(max_value);
+    bits_ = new word_t[numWords()]();
+    for (position_t idx = 0; idx < num_values_; idx++) write(idx, values[idx]);
+  }
+
+  ~ValueVector() {
+    if (!is_mapped_) delete[] bits_;
+  }
+
+  uint64_t read(const position_t idx) const {
+    assert(idx < num_values_);
+    if (width_ == 0) return 0;
+    uint64_t bit_pos = (uint64_t)idx * width_;
+    position_t word_id = bit_pos / kWordSize;
+    position_t offset = bit_pos % kWordSize;
+    word_t first = bits_[word_id] << offset;
+    if (offset + width_ <= kWordSize) return first >> (kWordSize - width_);
+    word_t rest = bits_[word_id + 1] >> (kWordSize - offset);
+    return (first | rest) >> (kWordSize - width_);
+  }
+
+  uint64_t operator[](const position_t idx) const { return read(idx); }
+
+  // in bits
+  level_t getWidth() const { return width_; }
+
+  position_t numValues() const { return num_values_; }
+
+  position_t numWords() const {
+    return (position_t)(((uint64_t)num_values_ * width_ + kWordSize - 1) /
+                        kWordSize);
+  }
+
+  // in bytes
+  position_t bitsSize() const { return numWords() * (kWordSize / 8); }
+
+  // in-memory bytes, mapped bits excluded
+  position_t size() const {
+    return sizeof(ValueVector) + (is_mapped_ ? 0 : bitsSize());
+  }
+
+  position_t serializedSize() const {
+    position_t size = sizeof(width_) + sizeof(num_values_) + bitsSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    out.write(&width_, sizeof(width_));
+    out.write(&num_values_, sizeof(num_values_));
+    out.write(bits_, bitsSize());
+    out.align();
+  }
+
+  // map leaves the bits in src, see loadArray. nullptr if the values run
+  // past end, see fitsImage.
+  static std::unique_ptr<ValueVector> deSerialize(char *&src,
+                                                  const bool map = false,
+                                                  const char *end = nullptr) {
+    auto values = std::make_unique<ValueVector>();
+    if (!fitsImage(src, end,
+                   sizeof(values->width_) + sizeof(values->num_values_)))
+      return nullptr;
+    memcpy(&(values->width_), src, sizeof(values->width_));
+    src += sizeof(values->width_);
+    memcpy(&(values->num_values_), src, sizeof(values->num_values_));
+    src += sizeof(values->num_values_);
+    if (values->width_ > kWordSize ||
+        !fitsImage(src, end, values->numWords(), kWordSize / 8))
+      return nullptr;
+    values->bits_ = loadArray<word_t>(src, values->bitsSize(), map,
+                                      values->is_mapped_);
+    src += values->bitsSize();
+    align(src);
+    return values;
+  }
+
+ private:
+  void write(const position_t idx, const uint64_t value) {
+    if (width_ == 0) return;
+    uint64_t bit_pos = (uint64_t)idx * width_;
+    position_t word_id = bit_pos / kWordSize;
+    position_t offset = bit_pos % kWordSize;
+    // left align the value, then split it over (at most) two words
+    word_t aligned = value << (kWordSize - width_);
+    bits_[word_id] |= aligned >> offset;
+    if (offset + width_ > kWordSize)
+      bits_[word_id + 1] |= aligned << (kWordSize - offset);
+  }
+
+  level_t width_;
+  position_t num_values_;
+  word_t *bits_;
+  // bits_ points into a mapped image, see loadArray
+  bool is_mapped_ = false;
+};
+
+}  // namespace mmphf_fst
+
+#endif  // VALUEVECTOR_H_
@@ -1,24 +1,37 @@
 #ifndef SURF_H_
 #define SURF_H_
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <queue>
+#include <random>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
+#include "include/automaton.hpp"
+#include "include/bloom_filter.hpp"
 #include "include/config.hpp"
+#include "include/file_writer.hpp"
 #include "include/fst_builder.hpp"
+#include "include/key_stats.hpp"
 #include "include/louds_dense.hpp"
 #include "include/louds_sparse.hpp"
+#include "include/mapped_file.hpp"
 
 namespace mmphf_fst {
 
+class MergingIter;
+
 class FST {
  public:
   class Iter {
    public:
     Iter() = default;
 
-    explicit Iter(const FST *filter) {
+    explicit Iter(const FST *filter) : fst_(filter) {
       dense_iter_ = LoudsDense::Iter(filter->louds_dense_.get());
       sparse_iter_ = LoudsSparse::Iter(filter->louds_sparse_.get());
     }
@@ -38,11 +51,28 @@ class FST {
 
     bool operator--(int);
 
+    // Moves forward to the first key >= key; stays if the current key is
+    // not smaller. Only the levels below the first byte where key leaves
+    // the current path are searched again, so short skips cost the
+    // divergence depth instead of the trie height. Truncated leaves are
+    // resolved with the original keys if attached (setKeys), otherwise with
+    // the suffix bits as in mayContainRange. Returns isValid().
+    bool skipTo(const std::string &key);
+
+    // Serializes the iterator's position for FST::resume, e.g., as the
+    // continuation token of a paginated scan. The token holds the path's
+    // label offsets per level (a few bytes each) and the FST's build stamp,
+    // value positions are ranked again on resume.
+    std::string saveToken() const;
+
     bool operator!=(const Iter &);
 
    private:
     void passToSparse();
 
+    // restores a path written by saveToken, false if it does not fit
+    bool restorePath(const char *&src, const char *end);
+
     bool incrementDenseIter();
 
     bool incrementSparseIter();
@@ -52,6 +82,7 @@ class FST {
     bool decrementSparseIter();
 
    private:
+    const FST *fst_ = nullptr;
     // true implies that dense_iter_ is valid
     LoudsDense::Iter dense_iter_;
     LoudsSparse::Iter sparse_iter_;
@@ -59,6 +90,59 @@ class FST {
     friend class FST;
   };
 
+  // Incremental prefix search, e.g., for search-as-you-type: the prefix
+  // grows and shrinks one byte at a time and every extend is a single trie
+  // step (see amacLookup) from the node below the current prefix. A stack
+  // holds one entry per prefix byte, so retract costs nothing. Requires
+  // buildKeyCounts() before the first extend.
+  class PrefixCursor {
+   public:
+    PrefixCursor() = default;
+
+    explicit PrefixCursor(const FST *filter) : fst_(filter) { reset(); }
+
+    // back to the empty prefix
+    void reset();
+
+    // Appends byte to the prefix. Returns false and keeps the prefix if no
+    // key starts with the result. Past a leaf, the bytes are checked
+    // against the leaf's original key if attached (setKeys), otherwise
+    // they are accepted and the leaf stays the only candidate, see
+    // isExact.
+    bool extend(char byte);
+
+    // removes the last byte of the prefix, false if it is empty
+    bool retract();
+
+    const std::string &getPrefix() const { return prefix_; }
+
+    // Rank interval [begin, end) of the keys starting with the prefix,
+    // i.e., their position interval if the FST stores key positions.
+    std::pair<uint64_t, uint64_t> range() const;
+
+    // the bytes extend accepts next, in ascending order
+    std::vector<label_t> children() const;
+
+    // false if the prefix goes past a truncated leaf that could not be
+    // verified (no original keys): the leaf only may start with it
+    bool isExact() const;
+
+   private:
+    // the node below a prefix, or the leaf it ends in
+    struct Step {
+      bool has_child;
+      bool is_dense;     // for leaves: next is a dense value position
+      position_t next;   // node number or value position, see NodeLabel
+      uint64_t begin;    // rank of the first key below, see range
+    };
+
+    const FST *fst_ = nullptr;
+    // entry i is the step after i bytes of prefix_, bytes past a leaf
+    // repeat it
+    std::vector<Step> path_;
+    std::string prefix_;
+  };
+
  public:
   FST() = default;
 
@@ -93,9 +177,23 @@ class FST {
     create(transformed_keys, kIncludeDense, kSparseDenseRatio);
   }
 
+  // bloom_bits_per_key > 0 adds a blocked Bloom filter that lookups consult
+  // before walking the trie. suffix_len > 0 stores that many hashed (kHash, at
+  // most 32) or real (kReal) suffix bits per key for mayContainRange.
   FST(const std::vector<std::string> &keys, const bool include_dense,
-      const uint32_t sparse_dense_ratio) {
-    create(keys, include_dense, sparse_dense_ratio);
+      const uint32_t sparse_dense_ratio, const uint32_t bloom_bits_per_key = 0,
+      const SuffixType suffix_type = kNone, const level_t suffix_len = 0) {
+    create(keys, nullptr, include_dense, sparse_dense_ratio,
+           bloom_bits_per_key, suffix_type, suffix_len);
+  }
+
+  // Stores values[i] for keys[i] instead of the key position i
+  FST(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+      const bool include_dense, const uint32_t sparse_dense_ratio,
+      const uint32_t bloom_bits_per_key = 0,
+      const SuffixType suffix_type = kNone, const level_t suffix_len = 0) {
+    create(keys, &values, include_dense, sparse_dense_ratio,
+           bloom_bits_per_key, suffix_type, suffix_len);
   }
 
   ~FST() = default;
@@ -103,12 +201,214 @@ class FST {
   void create(const std::vector<std::string> &keys, bool include_dense,
               uint32_t sparse_dense_ratio);
 
+  void create(const std::vector<std::string> &keys,
+              const std::vector<uint64_t> *values, bool include_dense,
+              uint32_t sparse_dense_ratio, uint32_t bloom_bits_per_key = 0,
+              SuffixType suffix_type = kNone, level_t suffix_len = 0);
+
+  // (Re-)builds the Bloom pre-filter over keys, e.g., for an FST that was
+  // re-encoded from its truncated keys. bits_per_key == 0 drops the filter.
+  void buildBloomFilter(const std::vector<std::string> &keys,
+                        uint32_t bits_per_key);
+
+  bool hasBloomFilter() const { return bloom_filter_ != nullptr; }
+
+  SuffixType getSuffixType() const {
+    return louds_sparse_->getSuffixes().getType();
+  }
+
+  level_t getSuffixLen() const {
+    return louds_sparse_->getSuffixes().getSuffixLen();
+  }
+
   bool lookupKey(const std::string &key, uint64_t &value) const;
 
+  // Longest prefix match in one descent: the value and length of the longest
+  // stored key that is a prefix of key, false if there is none. Keys that
+  // are prefixes of other keys are stored whole and match exactly. The leaf
+  // that ends the descent holds a truncated key: with use_keys it is checked
+  // against the original keys (see setKeys), otherwise it is taken as a
+  // match of its stored length, as lookupKey does.
+  bool longestPrefixMatch(const std::string &key, uint64_t &value,
+                          level_t &match_len, bool use_keys = true) const;
+
   bool lookupKey(uint32_t key, uint64_t &value) const;
 
   bool lookupKey(uint64_t key, uint64_t &value) const;
 
+  // Builds the value -> leaf directory used by keyAtPosition. It is not
+  // serialized, call it again after deSerialize.
+  void buildReverseIndex();
+
+  bool hasReverseIndex() const { return !reverse_leaves_.empty(); }
+
+  // Reverse lookup: reconstructs the stored key prefix of the leaf holding
+  // value by walking parent links up to the root. With real suffix bits, their
+  // whole bytes are appended (zero padded past the end of the key). Returns
+  // false if no key maps to value. Requires buildReverseIndex().
+  bool keyAtPosition(uint64_t value, std::string &key) const;
+
+  // Batch version of lookupKey for dictionary encoding: values[i] and
+  // found[i] belong to keys[i]. The keys are looked up in sorted order, a
+  // key resumes the descent of its predecessor at their common prefix, and
+  // kBatchInterleave runs of the sorted keys are walked in lock step to
+  // overlap their cache misses.
+  void encodeBatch(const std::vector<std::string_view> &keys,
+                   std::vector<uint64_t> &values,
+                   std::vector<uint8_t> &found) const;
+
+  // Result of decodeBatch: all keys back to back in one arena
+  struct KeyBatch {
+    std::string arena;
+    // key i is arena[offsets[i], offsets[i + 1])
+    std::vector<uint64_t> offsets;
+    std::vector<uint8_t> found;
+
+    size_t size() const { return found.size(); }
+
+    std::string_view operator[](size_t i) const {
+      return std::string_view(arena.data() + offsets[i],
+                              offsets[i + 1] - offsets[i]);
+    }
+  };
+
+  // Annotates the trie for topK: scores[i] belongs to the i-th key in sorted
+  // order (the build order). Stores the score of every leaf and the maximum
+  // score below every node, indexed by node number.
+  void buildScores(const std::vector<uint64_t> &scores);
+
+  bool hasScores() const { return leaf_scores_ != nullptr; }
+
+  // Result of topK. key is the stored (truncated) key prefix.
+  struct Completion {
+    std::string key;
+    uint64_t value;
+    uint64_t score;
+  };
+
+  // Returns up to k keys starting with prefix, highest score first (ties in
+  // key order). Best-first search over the subtree maxima: subtrees whose
+  // maximum is below the k-th best leaf score seen so far are never
+  // expanded. A leaf whose stored prefix is shorter than prefix only may
+  // match, as with lookupKey. Requires buildScores().
+  std::vector<Completion> topK(const std::string &prefix, size_t k) const;
+
+  // Calls visitor(value, is_exact) in key order for every key starting with
+  // prefix: one descent to the node below prefix, then its whole subtree.
+  // If the trie ends the descent at a leaf above depth prefix.size(), the
+  // leaf's truncated key only may continue with prefix: it is reported with
+  // is_exact == false for the caller to verify.
+  template <typename Visitor>
+  void prefixSearch(const std::string &prefix, Visitor &&visitor) const;
+
+  // Depth-first intersection with a deterministic automaton (see
+  // automaton.hpp): calls visitor(key, value, is_match) in key order for
+  // every leaf whose stored key prefix leaves the automaton alive, is_match
+  // tells whether it accepts the prefix itself. The stored prefix is
+  // truncated, so the caller verifies the rest against its original key.
+  // Subtrees are pruned as soon as the state is dead, dense nodes intersect
+  // the state's label set with their bitmap words.
+  template <typename Automaton, typename Visitor>
+  void intersect(const Automaton &automaton, Visitor &&visitor) const;
+
+  // Co-traverses the tries of a and b and calls visitor(value_a, value_b) in
+  // key order for every key stored in both. Only paths present in both tries
+  // are entered: each node pair keeps the labels in both label sets (word
+  // ANDs for dense nodes). A leaf facing an inner node of the other trie is
+  // resolved by a lookup from that node. Leaves are truncated, so both need
+  // their original keys (setKeys).
+  template <typename Visitor>
+  static void intersectKeys(const FST &a, const FST &b, Visitor &&visitor);
+
+  // Calls visitor(value_a) in key order for every key of a that b does not
+  // store. Subtrees of a whose path is missing from b are reported without
+  // touching b. Requires the original keys of both (setKeys).
+  template <typename Visitor>
+  static void differenceKeys(const FST &a, const FST &b, Visitor &&visitor);
+
+  // Annotates the trie for rank queries: the number of keys below every
+  // node, as prefix sums in node number order. It is not serialized, call it
+  // again after deSerialize.
+  void buildKeyCounts();
+
+  bool hasKeyCounts() const { return !key_count_sums_.empty(); }
+
+  uint64_t getNumKeys() const {
+    return louds_dense_->getNumValues() + louds_sparse_->getNumValues();
+  }
+
+  // Number of keys before iter's key in key order, getNumKeys() if iter is
+  // invalid. One countKeysBefore per level of its path. Requires
+  // buildKeyCounts().
+  uint64_t getRank(const FST::Iter &iter) const;
+
+  // Result of keysAtRanks and sample. key is the stored (truncated) key
+  // prefix.
+  struct RankedKey {
+    uint64_t rank;
+    std::string key;
+    uint64_t value;
+  };
+
+  // Resolves each rank (ascending, below getNumKeys()) to its leaf by a
+  // descent guided by the subtree key counts, binary searching the labels
+  // of every node. A rank resumes the path of its predecessor at the
+  // deepest node that holds both. Requires buildKeyCounts().
+  std::vector<RankedKey> keysAtRanks(const std::vector<uint64_t> &ranks) const;
+
+  // Draws k keys of [left_key, right_key] uniformly at random (with
+  // replacement), in key order: k ranks of the range's rank interval, then
+  // keysAtRanks. Costs two seeks and O(k * height) instead of a scan. The
+  // bounds are resolved with the original keys if attached (setKeys),
+  // otherwise with the suffix bits. Requires buildKeyCounts().
+  template <typename Rng>
+  std::vector<RankedKey> sample(const std::string &left_key,
+                                const std::string &right_key, size_t k,
+                                Rng &rng) const;
+
+  // Group by prefix: calls visitor(prefix, lo, hi) in key order for every
+  // distinct key prefix of length len, where [lo, hi) is the rank interval
+  // of the keys starting with it. Only the nodes above depth len are
+  // visited, the interval ends come from the subtree key counts. The trie
+  // ends some keys above depth len: such a key is a group of its own, its
+  // prefix is the original key's first len bytes if attached (setKeys),
+  // otherwise its shorter stored prefix. Keys shorter than len are groups
+  // of their own, too. Requires buildKeyCounts().
+  template <typename Visitor>
+  void forEachPrefix(level_t len, Visitor &&visitor) const;
+
+  // Same as above for the keys in [left_key, right_key], the first and last
+  // interval are clipped to them. The bounds are resolved as in sample.
+  template <typename Visitor>
+  void forEachPrefix(level_t len, const std::string &left_key,
+                     const std::string &right_key, Visitor &&visitor) const;
+
+  // Statistics sidecar (fanout and equi-depth histograms), built with the
+  // FST and serialized with it
+  const KeyStats &getKeyStats() const { return *key_stats_; }
+
+  // Estimated number of keys in [left_key, right_key] for query planning,
+  // from the equi-depth histogram alone: no trie walk, no leaves.
+  double estimateRangeCount(const std::string &left_key,
+                            const std::string &right_key) const;
+
+  // Estimated number of keys starting with prefix, see estimateRangeCount
+  double estimatePrefixCount(const std::string &prefix) const;
+
+  // Exact versions: the ranks of both bounds from two seeks. The ranks are
+  // the seeks' values if the FST stores key positions
+  // (KeyStats::valuesAreRanks), otherwise getRank (buildKeyCounts). Bounds
+  // are resolved as in sample.
+  uint64_t countRange(const std::string &left_key,
+                      const std::string &right_key) const;
+
+  uint64_t countPrefix(const std::string &prefix) const;
+
+  // Batch version of keyAtPosition: values are decoded in leaf order, each
+  // upward walk stops at the first node shared with its predecessor.
+  // Requires buildReverseIndex().
+  KeyBatch decodeBatch(const std::vector<uint64_t> &values) const;
+
   // this function is used by hybrid trie to continue a search started in
   // ARTHybrid
   inline bool lookupKeyAtNode(const char *key, uint64_t key_length,
@@ -121,6 +421,43 @@ class FST {
   inline bool amacLookup(const char keyByte, level_t level,
                          size_t &node_number) const;
 
+  // Same as lookupKey but also reports the trie level of the leaf that
+  // terminated the search
+  bool lookupKeyWithLevel(const std::string &key, uint64_t &value,
+                          level_t &leaf_level) const;
+
+  // Result of estimateFalsePositives. Because the trie is truncated at the
+  // unique key prefix, lookupKey accepts absent keys that share a stored
+  // prefix, the caller's verification then rejects them.
+  struct FalsePositiveStats {
+    uint64_t num_queries = 0;          // negative keys probed
+    uint64_t num_true_negatives = 0;   // rejected by the trie itself
+    uint64_t num_false_positives = 0;  // rejected only by verification
+    uint64_t num_positives_skipped = 0;  // sample keys that do exist
+    double false_positive_rate = 0;
+    // false positives by the level of the leaf that accepted the query
+    std::vector<uint64_t> false_positives_per_level;
+    // hashed fingerprint bits per key needed to reach the target rate
+    uint32_t fingerprint_bits = 0;
+    // real suffix bits per key needed to reach the target rate (at most 64)
+    uint32_t real_suffix_bits = 0;
+    // false positive rate remaining with real_suffix_bits
+    double real_suffix_rate = 0;
+  };
+
+  // Probes negative_keys and verifies every candidate against keys, the
+  // caller's key store indexed by value. Keys of the sample that are stored
+  // are skipped.
+  FalsePositiveStats estimateFalsePositives(
+      const std::vector<std::string> &keys,
+      const std::vector<std::string> &negative_keys, double target_rate) const;
+
+  // Same as above on num_samples synthetic near-miss keys: a random stored
+  // key keeps a random prefix, the remaining bytes are randomized.
+  FalsePositiveStats estimateFalsePositives(
+      const std::vector<std::string> &keys, uint64_t num_samples,
+      double target_rate, uint64_t seed = 42) const;
+
   void getNode(level_t level, size_t node_number, std::vector<uint8_t> &lables,
                std::vector<uint64_t> &values,
                std::vector<uint8_t> &prefix) const;
@@ -131,12 +468,41 @@ class FST {
   // and the stored key prefix matches key, iter stays at this key prefix.
   FST::Iter moveToKeyGreaterThan(const std::string &key, bool inclusive) const;
 
-  FST::Iter moveToKeyLessThan(const std::string &key) const;
+  // Moves to the greatest key smaller than key, or equal to it if
+  // inclusive, in a single descent (seekForPrev). Truncated leaves are
+  // resolved as in skipTo. The one-argument form keeps its strict bound.
+  FST::Iter moveToKeyLessThan(const std::string &key,
+                              bool inclusive = false) const;
+
+  // Batch version of moveToKeyGreaterThan: iters[i] belongs to keys[i].
+  // Windows of kSeekBatchWindow keys first walk their exact-match paths in
+  // lock step, one trie level per round, so that the cache misses of
+  // different keys overlap. The seeks, including their fallbacks to the next
+  // greater subtree, then run on the warm paths.
+  std::vector<FST::Iter> seekBatch(const std::vector<std::string_view> &keys,
+                                   bool inclusive) const;
+
+  // Range filter query: false means no stored key lies in [left_key,
+  // right_key]. Answers from the truncated trie and the suffix bits alone,
+  // i.e., never needs the original keys. Hashed suffixes only sharpen
+  // point queries (left_key == right_key), real suffixes also range queries.
+  bool mayContainRange(const std::string &left_key,
+                       const std::string &right_key) const;
 
   FST::Iter moveToFirst() const;
 
   FST::Iter moveToLast() const;
 
+  // Restores an iterator saved by Iter::saveToken in O(height), without a
+  // search and without touching the original keys. Returns false for tokens
+  // of another build of the FST (see getBuildStamp) or malformed ones. A
+  // token of an exhausted iterator restores an invalid iterator.
+  bool resume(const std::string &token, FST::Iter &iter) const;
+
+  // Fingerprint of the keys and values the FST was built from, serialized
+  // with it. Iterator tokens carry it to detect rebuilds.
+  uint64_t getBuildStamp() const { return build_stamp_; }
+
   std::pair<FST::Iter, FST::Iter> lookupRange(const std::string &left_key,
                                               bool left_inclusive,
                                               const std::string &right_key,
@@ -150,53 +516,522 @@ class FST {
 
   level_t getSparseStartLevel() const;
 
+  // one entry per trie level, dense levels first
+  std::vector<LevelStats> getLevelStats() const;
+
+  // (component name, bytes) pairs, adds up to roughly getMemoryUsage()
+  std::vector<std::pair<std::string, uint64_t>> getMemoryBreakdown() const;
+
+  // (Re-)attaches the (sorted) original keys, e.g., after deSerialize. The
+  // seek and range operations compare against them to resolve truncated key
+  // prefixes, point lookups work without.
+  void setKeys(const std::vector<std::string> &keys) {
+    louds_dense_->setKeys(keys);
+    louds_sparse_->setKeys(keys);
+  }
+
   char *serialize() const {
     uint64_t size = serializedSize();
-    char *data = new char[size];
+    // zeroed, so that alignment padding matches what serializeTo writes
+    char *data = new char[size]();
     char *cur_data = data;
-    louds_dense_->serialize(cur_data);
-    louds_sparse_->serialize(cur_data);
+    serialize(cur_data);
     assert(cur_data - data == (int64_t)size);
     return data;
   }
 
-  static FST *deSerialize(char *src) {
-    FST *surf = new FST();
-    surf->louds_dense_ = LoudsDense::deSerialize(src);
-    surf->louds_sparse_ = LoudsSparse::deSerialize(src);
-    surf->iter_ = FST::Iter(surf);
+  // writes serializedSize() bytes to dst and advances it, e.g., to embed the
+  // FST in a larger image
+  void serialize(char *&dst) const {
+    BufferWriter out(dst);
+    serialize(out);
+  }
+
+  // Streams the serialized FST to fd, from its current offset, without an
+  // image in memory: the components' arrays are written in place (see
+  // FileWriter). sync calls fsync at the end. False if a write failed.
+  bool serializeTo(const int fd, const bool sync = true) const {
+    FileWriter out(fd);
+    serialize(out);
+    return out.finish(sync);
+  }
+
+  // serialize to a BufferWriter or FileWriter
+  template <typename Writer>
+  void serialize(Writer &out) const {
+    uint64_t size = serializedSize();
+    out.write(&kSerialMagic, sizeof(kSerialMagic));
+    out.write(&size, sizeof(size));
+    louds_dense_->serialize(out);
+    louds_sparse_->serialize(out);
+    // an empty filter (0 blocks) marks the absence of the pre-filter
+    if (bloom_filter_)
+      bloom_filter_->serialize(out);
+    else
+      BlockedBloomFilter().serialize(out);
+    // topK annotation, empty if absent
+    if (leaf_scores_) {
+      leaf_scores_->serialize(out);
+      node_max_scores_->serialize(out);
+    } else {
+      ValueVector().serialize(out);
+      ValueVector().serialize(out);
+    }
+    out.write(&build_stamp_, sizeof(build_stamp_));
+    key_stats_->serialize(out);
+  }
+
+  // map leaves the bulk of the sparse levels (labels, child indicator and
+  // LOUDS bits, suffixes, values) and the topK scores in src, which must then
+  // outlive the FST; the dense levels, the rank and select directories and
+  // the pre-filter are copied. See mapFile. end, if set, bounds an image that
+  // may be truncated or corrupt: the header must pass isImage and no section
+  // may run past end, or deSerialize returns nullptr. It does not check the
+  // trie itself.
+  static FST *deSerialize(char *src, const bool map = false,
+                          const char *end = nullptr) {
+    if (end != nullptr && !isImage(src, end - src)) return nullptr;
+    std::unique_ptr<FST> surf(new FST());
+    src += kSerialHeaderSize;
+    surf->louds_dense_ = LoudsDense::deSerialize(src, end);
+    if (!surf->louds_dense_) return nullptr;
+    surf->louds_sparse_ = LoudsSparse::deSerialize(src, map, end);
+    if (!surf->louds_sparse_ ||
+        surf->louds_sparse_->getStartLevel() != surf->louds_dense_->getHeight())
+      return nullptr;
+    surf->bloom_filter_ = BlockedBloomFilter::deSerialize(src, end);
+    if (!surf->bloom_filter_) return nullptr;
+    if (surf->bloom_filter_->numBlocks() == 0) surf->bloom_filter_.reset();
+    surf->leaf_scores_ = ValueVector::deSerialize(src, map, end);
+    if (!surf->leaf_scores_) return nullptr;
+    surf->node_max_scores_ = ValueVector::deSerialize(src, map, end);
+    if (!surf->node_max_scores_) return nullptr;
+    if (surf->leaf_scores_->numValues() == 0) {
+      surf->leaf_scores_.reset();
+      surf->node_max_scores_.reset();
+    } else if (surf->leaf_scores_->numValues() !=
+                   surf->louds_dense_->getNumValues() +
+                       surf->louds_sparse_->getNumValues() ||
+               surf->node_max_scores_->numValues() !=
+                   surf->louds_sparse_->getNodeCount()) {
+      return nullptr;  // one score per leaf and per node
+    }
+    if (!fitsImage(src, end, sizeof(surf->build_stamp_))) return nullptr;
+    memcpy(&surf->build_stamp_, src, sizeof(surf->build_stamp_));
+    src += sizeof(surf->build_stamp_);
+    surf->key_stats_ = KeyStats::deSerialize(src, end);
+    if (!surf->key_stats_) return nullptr;
+    surf->iter_ = FST::Iter(surf.get());
+    return surf.release();
+  }
+
+  // True if the size bytes at src start with the header of a serialized FST
+  // whose image they hold in full. Does not validate the image itself.
+  static bool isImage(const char *src, const uint64_t size) {
+    if (size < kSerialHeaderSize) return false;
+    uint64_t magic = 0, image_size = 0;
+    memcpy(&magic, src, sizeof(magic));
+    memcpy(&image_size, src + sizeof(magic), sizeof(image_size));
+    return magic == kSerialMagic && image_size >= kSerialHeaderSize &&
+           image_size <= size;
+  }
+
+  // Disk-resident FST: maps a serialized FST file and deserializes it with
+  // map set, so only the dense levels and directories take memory and the
+  // sparse levels are paged in as lookups touch them. The FST owns the
+  // mapping. nullptr if the file can not be mapped or does not hold an FST
+  // image in full.
+  static FST *mapFile(const std::string &path) {
+    std::unique_ptr<MappedFile> file = MappedFile::open(path);
+    if (!file) return nullptr;
+    FST *surf = deSerialize(file->data(), true, file->data() + file->size());
+    if (surf) surf->mapped_file_ = std::move(file);
     return surf;
   }
 
  private:
+  // a serialized FST starts with kSerialMagic and its size in bytes
+  static const uint64_t kSerialMagic = 0x3154534648504d4d;  // "MMPHFST1"
+  static const uint64_t kSerialHeaderSize = 2 * sizeof(uint64_t);
+
   std::unique_ptr<LoudsSparse> louds_sparse_;
   std::unique_ptr<FSTBuilder> builder_;
   std::unique_ptr<LoudsDense> louds_dense_;
+  // optional pre-filter, rejects most absent keys before the trie walk
+  std::unique_ptr<BlockedBloomFilter> bloom_filter_;
+  // value -> leaf directory of keyAtPosition:
+  // (position << 2) | (is_prefix_key << 1) | is_sparse, see getLeaves.
+  // Indexed by value if the values are 0..n-1, otherwise parallel to the
+  // sorted reverse_values_.
+  std::vector<uint64_t> reverse_leaves_;
+  std::vector<uint64_t> reverse_values_;
+
+  // topK annotation, null if absent: score per leaf (see getLeafId) and the
+  // maximum leaf score below every node, indexed by node number. Both are
+  // bit-packed at the width of the largest score.
+  std::unique_ptr<ValueVector> leaf_scores_;
+  std::unique_ptr<ValueVector> node_max_scores_;
+
+  // see getBuildStamp
+  uint64_t build_stamp_ = 0;
+  // see getKeyStats
+  std::unique_ptr<KeyStats> key_stats_;
+  // the image of a mapped FST, see mapFile
+  std::unique_ptr<MappedFile> mapped_file_;
+
+  // key_count_sums_[node_num] is the number of keys below the nodes before
+  // node_num, see buildKeyCounts
+  std::vector<uint64_t> key_count_sums_;
+
+  // number of sorted key runs encodeBatch walks in lock step
+  static const uint64_t kBatchInterleave = 4;
+  // keys a run prefetches ahead
+  static const uint64_t kBatchPrefetchDistance = 4;
+  // keys seekBatch walks in lock step
+  static const uint64_t kSeekBatchWindow = 16;
+  // first byte of an iterator token, bumped when its layout changes
+  static const char kTokenFormat = 1;
+
+  static uint64_t computeBuildStamp(const std::vector<std::string> &keys,
+                                    const std::vector<uint64_t> *values);
+
+  // appends the labels of node_num, which lives in LoudsDense if is_dense;
+  // label_set restricts them if not null
+  void getNodeLabels(position_t node_num, std::vector<NodeLabel> &node_labels,
+                     bool &is_dense, const word_t *label_set = nullptr) const;
+
+  // visits the leaves below node_num for intersect, key holds its path
+  template <typename Automaton, typename Visitor>
+  void intersectNode(const Automaton &automaton,
+                     const typename Automaton::State &state,
+                     position_t node_num, std::string &key,
+                     Visitor &visitor) const;
+
+  // the labels of node_num as a label set, see LoudsDense::getLabelSet
+  void getLabelSet(position_t node_num, word_t *label_set) const {
+    if (node_num < louds_sparse_->getNodeCountDense())
+      louds_dense_->getLabelSet(node_num, label_set);
+    else
+      louds_sparse_->getLabelSet(node_num, label_set);
+  }
+
+  // intersectKeys and differenceKeys below node_a of a and node_b of b, which
+  // share the same path of length level
+  template <typename Visitor>
+  static void intersectNodes(const FST &a, position_t node_a, const FST &b,
+                             position_t node_b, level_t level,
+                             Visitor &visitor);
+
+  template <typename Visitor>
+  static void differenceNodes(const FST &a, position_t node_a, const FST &b,
+                              position_t node_b, level_t level,
+                              Visitor &visitor);
+
+  // forEachPrefix below node_num, whose keys start at rank, for the keys of
+  // the rank interval [begin, end); key holds the node's path
+  template <typename Visitor>
+  void forEachPrefixNode(position_t node_num, uint64_t rank, level_t len,
+                         uint64_t begin, uint64_t end, std::string &key,
+                         Visitor &visitor) const;
+
+  // calls visitor(value) for every key below node_num in key order
+  template <typename Visitor>
+  void visitSubtree(position_t node_num, Visitor &&visitor) const;
+
+  // rank of the first key >= key (> key if !inclusive), see countRange
+  uint64_t getBoundRank(const std::string &key, bool inclusive) const;
+
+  // the first key after all keys starting with prefix, empty if there is
+  // none (prefix is empty or all 0xFF)
+  static std::string getPrefixSuccessor(std::string prefix) {
+    while (!prefix.empty() && (label_t)prefix.back() == 0xFF)
+      prefix.pop_back();
+    if (!prefix.empty()) prefix.back()++;
+    return prefix;
+  }
+
+  // number of keys below node_num
+  uint64_t getKeyCount(position_t node_num) const {
+    return key_count_sums_[node_num + 1] - key_count_sums_[node_num];
+  }
+
+  // the original key with value, see setKeys
+  const std::string &getOriginalKey(uint64_t value) const {
+    assert(louds_sparse_->getKeys() != nullptr);
+    return (*louds_sparse_->getKeys())[value];
+  }
+
+  // lookupKeyAtNode, verified against the original keys
+  bool lookupOriginalKeyAtNode(const std::string &key, level_t level,
+                               position_t node_num, uint64_t &value) const {
+    return lookupKeyAtNode(key.data(), key.length(), level, node_num,
+                           value) &&
+           getOriginalKey(value) == key;
+  }
+
+  uint64_t getValue(bool is_dense, position_t value_pos) const {
+    return is_dense ? louds_dense_->getValue(value_pos)
+                    : louds_sparse_->getValue(value_pos);
+  }
+
+  // value of the key that ends at node_num (a prefix of other keys), false
+  // if there is none
+  bool getPrefixKeyValue(position_t node_num, uint64_t &value) const;
+
+  // index into leaf_scores_, dense leaves first
+  uint64_t getLeafId(bool is_dense, position_t value_pos) const {
+    return is_dense ? value_pos : louds_dense_->getNumValues() + value_pos;
+  }
+
+  // slot of value in the reverse index, false if no key maps to value
+  bool findReverseSlot(uint64_t value, uint64_t &slot) const;
+
+  // Reconstructs the trie path of leaf (a reverse index entry). On input,
+  // key and ancestors (node number per depth) describe the previously
+  // decoded path; the walk stops at the first node on it. Both are updated.
+  void decodeLeaf(uint64_t leaf, std::string &key,
+                  std::vector<position_t> &ancestors) const;
+
+  // appends the whole bytes of the leaf's real suffix, if any
+  void appendRealSuffix(uint64_t leaf, std::string &key) const;
+
+  // use_keys == false compares leaves by their suffix bits only, see
+  // LoudsDense::moveToKeyGreaterThan
+  FST::Iter moveToKeyGreaterThan(const std::string &key, bool inclusive,
+                                 bool use_keys) const;
+
+  // moveToKeyGreaterThan on iter, keeping its path above level (see
+  // LoudsDense::moveToKeyGreaterThan)
+  void moveToKeyGreaterThan(const std::string &key, bool inclusive,
+                            bool use_keys, level_t level,
+                            FST::Iter &iter) const;
 
   FST::Iter iter_;
   FST::Iter end_;
+
+  friend class MergingIter;
+};
+
+// Merged view over the keys of several FSTs in key order, e.g. the runs of an
+// LSM level. A loser tree over the sources' iterators finds the next key in
+// log2(N) comparisons. Sources with original keys (setKeys) are compared
+// through them without copying; otherwise the stored (truncated) keys are
+// compared, which orders keys sharing a stored prefix only approximately.
+// Equal keys come out in source order.
+class MergingIter {
+ public:
+  explicit MergingIter(const std::vector<const FST *> &sources);
+
+  // moves every source to its first key >= key (> key if !inclusive)
+  void seek(const std::string &key, bool inclusive = true);
+
+  void seekToFirst();
+
+  bool isValid() const;
+
+  // index of the current key's FST in sources
+  size_t getSource() const;
+
+  // the current key's value (position) in its source
+  uint64_t getValue() const;
+
+  // the current key, as stored by its source
+  std::string getKey() const;
+
+  // Returns true if the status of the iterator after the operation is valid
+  bool operator++(int);
+
+ private:
+  // whether source a's key comes before source b's, exhausted sources last
+  bool isBefore(size_t a, size_t b) const;
+
+  // caches the current key of source if it has no original keys
+  void loadKey(size_t source);
+
+  // plays the subtree of tree node node, returns its winner
+  size_t build(size_t node);
+
+  // updates the path from source's leaf to the root after source moved
+  void replay(size_t source);
+
+  std::vector<const FST *> sources_;
+  std::vector<FST::Iter> iters_;
+  std::vector<std::string> keys_;
+  // tree_[0] holds the winner, tree_[1..N-1] the loser of each inner node;
+  // source i is leaf N + i
+  std::vector<size_t> tree_;
+};
+
+// Companion index for "ends with" queries, e.g., domain suffixes or file
+// extensions: an FST over the byte-reversed keys whose values are those of
+// the original keys (their positions by default). A suffix query is a
+// prefixSearch on it and reports positions of the forward FST.
+class SuffixIndex {
+ public:
+  SuffixIndex() = default;
+
+  // keys as for FST(keys), i.e., sorted; values[i] belongs to keys[i]
+  // (default: position i)
+  explicit SuffixIndex(const std::vector<std::string> &keys,
+                       const std::vector<uint64_t> *values = nullptr,
+                       bool include_dense = kIncludeDense,
+                       uint32_t sparse_dense_ratio = kSparseDenseRatio);
+
+  // Attaches the original (not reversed) keys, indexed by value. They
+  // verify keys the reversed trie stores shorter than the suffix.
+  void setKeys(const std::vector<std::string> &keys) { keys_ = &keys; }
+
+  // Values of the keys ending with suffix, ordered by their reversed keys.
+  // Without the original keys, a key whose stored reversed prefix is
+  // shorter than suffix is reported as a candidate (as in lookupKey).
+  std::vector<uint64_t> suffixRange(const std::string &suffix) const;
+
+  const FST &getReversedFST() const { return *reversed_; }
+
+  uint64_t serializedSize() const { return reversed_->serializedSize(); }
+
+  uint64_t getMemoryUsage() const {
+    return sizeof(SuffixIndex) + reversed_->getMemoryUsage();
+  }
+
+  char *serialize() const { return reversed_->serialize(); }
+
+  // see FST::serializeTo
+  bool serializeTo(const int fd, const bool sync = true) const {
+    return reversed_->serializeTo(fd, sync);
+  }
+
+  static SuffixIndex *deSerialize(char *src) {
+    SuffixIndex *index = new SuffixIndex();
+    index->reversed_.reset(FST::deSerialize(src));
+    return index;
+  }
+
+ private:
+  // the reversed keys are not kept, nothing here seeks with them
+  std::unique_ptr<FST> reversed_;
+  const std::vector<std::string> *keys_ = nullptr;
+};
+
+// Sparse index of a sorted, blocked file (SSTable, Parquet pages): maps a key
+// to the block that holds it. The trie stores one separator per block, the
+// shortest string s with last key of the previous block < s <= first key of
+// the block, so it grows with the number of blocks rather than keys. The
+// separators are kept (they are short) and attached as the FST's original
+// keys, which makes every answer exact. Block numbers are bit-packed at the
+// width of the largest one.
+class BlockIndex {
+ public:
+  BlockIndex() = default;
+
+  // keys sorted, blocks[i] the block of keys[i], non-decreasing; a key must
+  // not span two blocks
+  BlockIndex(const std::vector<std::string> &keys,
+             const std::vector<uint64_t> &blocks,
+             bool include_dense = kIncludeDense,
+             uint32_t sparse_dense_ratio = kSparseDenseRatio);
+
+  // The block that holds key if the file does: the last block whose
+  // separator is <= key. False if key sorts before the first block.
+  bool lookupBlock(const std::string &key, uint64_t &block) const;
+
+  // The blocks [first_block, last_block] that hold the keys in [left_key,
+  // right_key], false if there are none. One seek per bound.
+  bool lookupBlockRange(const std::string &left_key,
+                        const std::string &right_key, uint64_t &first_block,
+                        uint64_t &last_block) const;
+
+  uint64_t getNumBlocks() const { return separators_.size(); }
+
+  const FST &getFST() const { return *fst_; }
+
+  uint64_t serializedSize() const;
+
+  uint64_t getMemoryUsage() const;
+
+  char *serialize() const;
+
+  // see FST::serializeTo
+  bool serializeTo(int fd, bool sync = true) const;
+
+  static BlockIndex *deSerialize(char *src);
+
+ private:
+  template <typename Writer>
+  void serialize(Writer &out) const;
+
+  // the FST's values are separator indexes, block_numbers_ maps them to
+  // block numbers
+  std::unique_ptr<FST> fst_;
+  std::vector<std::string> separators_;
+  std::unique_ptr<ValueVector> block_numbers_;
 };
 
+const uint64_t FST::kSerialMagic;
+const uint64_t FST::kSerialHeaderSize;
+const uint64_t FST::kBatchInterleave;
+const uint64_t FST::kBatchPrefetchDistance;
+const uint64_t FST::kSeekBatchWindow;
+const char FST::kTokenFormat;
+
 void FST::create(const std::vector<std::string> &keys, const bool include_dense,
                  const uint32_t sparse_dense_ratio) {
-  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio);
-  builder_->build(keys);
+  create(keys, nullptr, include_dense, sparse_dense_ratio);
+}
+
+void FST::create(const std::vector<std::string> &keys,
+                 const std::vector<uint64_t> *values, const bool include_dense,
+                 const uint32_t sparse_dense_ratio,
+                 const uint32_t bloom_bits_per_key,
+                 const SuffixType suffix_type, const level_t suffix_len) {
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio,
+                                          bloom_bits_per_key, suffix_type,
+                                          suffix_len);
+  if (values)
+    builder_->build(keys, *values);
+  else
+    builder_->build(keys);
   louds_dense_ = std::make_unique<LoudsDense>(builder_.get(), keys);
   louds_sparse_ = std::make_unique<LoudsSparse>(builder_.get(), keys);
+  bloom_filter_ = builder_->releaseBloomFilter();
+  key_stats_ = builder_->releaseKeyStats();
+  build_stamp_ = computeBuildStamp(keys, values);
   iter_ = FST::Iter(this);
   builder_.reset();
 }
 
+uint64_t FST::computeBuildStamp(const std::vector<std::string> &keys,
+                                const std::vector<uint64_t> *values) {
+  uint64_t stamp = keys.size();
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    stamp ^= Hash(keys[i].data(), keys[i].size(), (uint32_t)(stamp >> 32));
+    if (values) stamp ^= (*values)[i] << 32;
+    stamp *= 0x9e3779b97f4a7c15;
+  }
+  return stamp;
+}
+
+void FST::buildBloomFilter(const std::vector<std::string> &keys,
+                           const uint32_t bits_per_key) {
+  bloom_filter_.reset();
+  if (bits_per_key == 0) return;
+  bloom_filter_ =
+      std::make_unique<BlockedBloomFilter>(keys.size(), bits_per_key);
+  for (const auto &key : keys) bloom_filter_->insert(key);
+}
+
 bool FST::lookupKey(const uint32_t key, uint64_t &value) const {
   // transform uint32 to string
   uint32_t endian_swapped_word = __builtin_bswap32(key);
   std::string transformed_key =
       std::string(reinterpret_cast<const char *>(&endian_swapped_word), 4);
+  if (bloom_filter_ && !bloom_filter_->mayContain(transformed_key))
+    return false;
 
   position_t connect_node_num = 0;
   if (!louds_dense_->lookupKey(transformed_key, connect_node_num, value))
     return false;
-  else if (connect_node_num != 0)
+  else if (connect_node_num != 0 || louds_dense_->getHeight() == 0)
     return louds_sparse_->lookupKey(transformed_key, connect_node_num, value);
   return true;
 }
@@ -206,24 +1041,839 @@ bool FST::lookupKey(const uint64_t key, uint64_t &value) const {
   uint64_t endian_swapped_word = __builtin_bswap64(key);
   std::string transformed_key =
       std::string(reinterpret_cast<const char *>(&endian_swapped_word), 8);
+  if (bloom_filter_ && !bloom_filter_->mayContain(transformed_key))
+    return false;
 
   position_t connect_node_num = 0;
   if (!louds_dense_->lookupKey(transformed_key, connect_node_num, value))
     return false;
-  else if (connect_node_num != 0)
+  else if (connect_node_num != 0 || louds_dense_->getHeight() == 0)
     return louds_sparse_->lookupKey(transformed_key, connect_node_num, value);
   return true;
 }
 
 bool FST::lookupKey(const std::string &key, uint64_t &value) const {
+  if (bloom_filter_ && !bloom_filter_->mayContain(key)) return false;
   position_t connect_node_num = 0;
   if (!louds_dense_->lookupKey(key, connect_node_num, value))
     return false;
-  else if (connect_node_num != 0)
+  else if (connect_node_num != 0 || louds_dense_->getHeight() == 0)
     return louds_sparse_->lookupKey(key, connect_node_num, value);
   return true;
 }
 
+bool FST::longestPrefixMatch(const std::string &key, uint64_t &value,
+                             level_t &match_len, const bool use_keys) const {
+  bool found = false;
+  position_t node_num = 0;
+  for (level_t level = 0;; level++) {
+    uint64_t prefix_value = 0;
+    if (getPrefixKeyValue(node_num, prefix_value)) {  // key[0, level) is stored
+      value = prefix_value;
+      match_len = level;
+      found = true;
+    }
+    if (level == key.length()) return found;
+
+    NodeLabel node_label;
+    bool is_dense = node_num < louds_sparse_->getNodeCountDense();
+    if (!(is_dense ? louds_dense_->findLabel(node_num, key[level], node_label)
+                   : louds_sparse_->findLabel(node_num, key[level],
+                                              node_label)))
+      return found;
+    if (node_label.has_child) {
+      node_num = node_label.next;
+      continue;
+    }
+
+    // the stored key may continue past the leaf
+    uint64_t leaf_value = getValue(is_dense, node_label.next);
+    level_t leaf_len = level + 1;
+    if (use_keys) {
+      assert(louds_sparse_->getKeys() != nullptr);
+      const std::string &stored_key = (*louds_sparse_->getKeys())[leaf_value];
+      if (stored_key.length() > key.length() ||
+          key.compare(0, stored_key.length(), stored_key) != 0)
+        return found;
+      leaf_len = stored_key.length();
+    }
+    value = leaf_value;
+    match_len = leaf_len;
+    return true;
+  }
+}
+
+bool FST::getPrefixKeyValue(const position_t node_num, uint64_t &value) const {
+  if (node_num < louds_sparse_->getNodeCountDense()) {
+    if (!louds_dense_->isPrefixKey(node_num)) return false;
+    value =
+        louds_dense_->getValue(louds_dense_->getPrefixKeyValuePos(node_num));
+  } else {
+    if (!louds_sparse_->isPrefixKey(node_num)) return false;
+    value =
+        louds_sparse_->getValue(louds_sparse_->getPrefixKeyValuePos(node_num));
+  }
+  return true;
+}
+
+void FST::buildReverseIndex() {
+  // indexed by (is_prefix_key << 1) | is_sparse
+  std::vector<std::pair<uint64_t, position_t>> leaves[4];
+  louds_dense_->getLeaves(leaves[0], leaves[2]);
+  louds_sparse_->getLeaves(leaves[1], leaves[3]);
+
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  for (uint64_t kind = 0; kind < 4; kind++)
+    for (auto &leaf : leaves[kind])
+      entries.emplace_back(leaf.first, ((uint64_t)leaf.second << 2u) | kind);
+  std::sort(entries.begin(), entries.end());
+
+  reverse_leaves_.clear();
+  reverse_values_.clear();
+  bool is_identity = true;
+  for (uint64_t i = 0; i < entries.size(); i++) {
+    reverse_leaves_.push_back(entries[i].second);
+    is_identity = is_identity && entries[i].first == i;
+  }
+  if (!is_identity)
+    for (auto &entry : entries) reverse_values_.push_back(entry.first);
+}
+
+bool FST::findReverseSlot(const uint64_t value, uint64_t &slot) const {
+  slot = value;
+  if (!reverse_values_.empty()) {
+    auto it = std::lower_bound(reverse_values_.begin(), reverse_values_.end(),
+                               value);
+    if (it == reverse_values_.end() || *it != value) return false;
+    slot = it - reverse_values_.begin();
+  }
+  return slot < reverse_leaves_.size();
+}
+
+void FST::decodeLeaf(const uint64_t leaf, std::string &key,
+                     std::vector<position_t> &ancestors) const {
+  position_t pos = leaf >> 2u;
+  bool is_sparse = leaf & 1u;
+  // a prefix key ends at the node of pos, without a label of its own
+  bool has_label = !(leaf & 2u);
+  std::string reversed_key;
+  std::vector<position_t> reversed_nodes;
+  // node numbers grow with the depth, so the previous path is searched
+  // backwards while walking up
+  size_t depth = ancestors.size();
+  bool is_shared = false;
+  while (true) {
+    position_t node_num = is_sparse ? louds_sparse_->getNodeNum(pos)
+                                    : louds_dense_->getNodeNum(pos);
+    if (has_label)
+      reversed_key.push_back(is_sparse ? (char)louds_sparse_->getLabel(pos)
+                                       : (char)louds_dense_->getLabel(pos));
+    has_label = true;
+    while (depth > 0 && ancestors[depth - 1] > node_num) depth--;
+    if (depth > 0 && ancestors[depth - 1] == node_num) {
+      depth--;
+      is_shared = true;
+      break;
+    }
+    reversed_nodes.push_back(node_num);
+    if (node_num == 0) break;  // root
+    if (is_sparse && node_num > louds_sparse_->getChildCountDense()) {
+      pos = louds_sparse_->getParentPos(node_num);
+    } else {
+      pos = louds_dense_->getParentPos(node_num);
+      is_sparse = false;
+    }
+  }
+  // the label found last sits at depth
+  key.resize(is_shared ? depth : 0);
+  key.append(reversed_key.rbegin(), reversed_key.rend());
+  ancestors.resize(is_shared ? depth + 1 : 0);
+  ancestors.insert(ancestors.end(), reversed_nodes.rbegin(),
+                   reversed_nodes.rend());
+}
+
+void FST::appendRealSuffix(const uint64_t leaf, std::string &key) const {
+  if (leaf & 2u) return;  // prefix keys are stored whole
+  position_t pos = leaf >> 2u;
+  bool is_sparse = leaf & 1u;
+  const BitvectorSuffix &suffixes = is_sparse ? louds_sparse_->getSuffixes()
+                                              : louds_dense_->getSuffixes();
+  if (suffixes.getType() != kReal) return;
+  position_t value_pos = is_sparse ? louds_sparse_->getValuePos(pos)
+                                   : louds_dense_->getValuePos(pos);
+  uint64_t suffix = suffixes.read(value_pos);
+  for (level_t bits = suffixes.getSuffixLen(); bits >= 8; bits -= 8)
+    key.push_back((char)(suffix >> (bits - 8)));
+}
+
+bool FST::keyAtPosition(const uint64_t value, std::string &key) const {
+  assert(hasReverseIndex());
+  uint64_t slot = 0;
+  if (!findReverseSlot(value, slot)) return false;
+  std::vector<position_t> ancestors;
+  key.clear();
+  decodeLeaf(reverse_leaves_[slot], key, ancestors);
+  appendRealSuffix(reverse_leaves_[slot], key);
+  return true;
+}
+
+void FST::encodeBatch(const std::vector<std::string_view> &keys,
+                      std::vector<uint64_t> &values,
+                      std::vector<uint8_t> &found) const {
+  values.assign(keys.size(), 0);
+  found.assign(keys.size(), 0);
+  std::vector<uint64_t> order(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (!std::is_sorted(keys.begin(), keys.end())) {
+    // sort (big endian 8 byte key prefix, index) pairs, the key bytes are
+    // only touched again for ties
+    std::vector<std::pair<uint64_t, uint64_t>> sorted_keys(keys.size());
+    for (uint64_t i = 0; i < keys.size(); i++) {
+      uint64_t prefix = 0;
+      if (!keys[i].empty())
+        memcpy(&prefix, keys[i].data(), std::min<size_t>(keys[i].size(), 8));
+      sorted_keys[i] = {__builtin_bswap64(prefix), i};
+    }
+    std::sort(sorted_keys.begin(), sorted_keys.end(),
+              [&keys](const std::pair<uint64_t, uint64_t> &a,
+                      const std::pair<uint64_t, uint64_t> &b) {
+                if (a.first != b.first) return a.first < b.first;
+                return keys[a.second] < keys[b.second];
+              });
+    for (uint64_t i = 0; i < keys.size(); i++)
+      order[i] = sorted_keys[i].second;
+  }
+
+  // one cursor per run of sorted keys. path[l] is the node number before
+  // consuming byte l of prev_key, valid for l < path_len
+  struct Cursor {
+    uint64_t next;
+    uint64_t end;
+    uint64_t idx;
+    bool is_walking;
+    level_t level;
+    std::string_view prev_key;
+    std::vector<size_t> path;
+    level_t path_len;
+  };
+  std::vector<Cursor> cursors;
+  for (uint64_t i = 0; i < kBatchInterleave; i++) {
+    uint64_t begin = keys.size() * i / kBatchInterleave;
+    uint64_t end = keys.size() * (i + 1) / kBatchInterleave;
+    if (begin == end) continue;
+    cursors.push_back({begin, end, 0, false, 0, std::string_view(),
+                       std::vector<size_t>(getHeight() + 1, 0), 1});
+  }
+
+  size_t num_active = cursors.size();
+  while (num_active > 0) {
+    num_active = 0;
+    for (Cursor &cursor : cursors) {
+      // start the next key of the run that passes the pre-filter
+      while (!cursor.is_walking && cursor.next < cursor.end) {
+        // the runs gather keys and scatter values in random order
+        if (cursor.next + kBatchPrefetchDistance < cursor.end) {
+          uint64_t ahead = order[cursor.next + kBatchPrefetchDistance];
+          __builtin_prefetch(keys[ahead].data());
+          __builtin_prefetch(&values[ahead], 1);
+          __builtin_prefetch(&found[ahead], 1);
+        }
+        cursor.idx = order[cursor.next++];
+        std::string_view key = keys[cursor.idx];
+        if (bloom_filter_ && !bloom_filter_->mayContain(key.data(), key.size()))
+          continue;
+        level_t common = 0;
+        while (common < key.size() && common < cursor.prev_key.size() &&
+               key[common] == cursor.prev_key[common])
+          common++;
+        cursor.level = std::min(common, cursor.path_len - 1);
+        cursor.prev_key = key;
+        cursor.is_walking = true;
+      }
+      if (!cursor.is_walking) continue;
+      num_active++;
+      // one trie level per round, other runs' loads overlap with this one
+      std::string_view key = cursor.prev_key;
+      level_t level = cursor.level;
+      size_t node_number = cursor.path[level];
+      if (level >= key.size()) {  // the key may end at this node
+        found[cursor.idx] = getPrefixKeyValue(node_number, values[cursor.idx]);
+        cursor.path_len = level + 1;
+        cursor.is_walking = false;
+      } else if (!amacLookup(key[level], level, node_number)) {
+        cursor.path_len = level + 1;
+        cursor.is_walking = false;
+      } else if ((node_number & 3u) == 1u) {  // branch terminates
+        values[cursor.idx] = node_number >> 2u;
+        found[cursor.idx] = 1;
+        cursor.path_len = level + 1;
+        cursor.is_walking = false;
+      } else {
+        cursor.path[level + 1] = node_number >> 2u;
+        cursor.level++;
+      }
+    }
+  }
+}
+
+void FST::getNodeLabels(const position_t node_num,
+                        std::vector<NodeLabel> &node_labels, bool &is_dense,
+                        const word_t *label_set) const {
+  is_dense = node_num < louds_sparse_->getNodeCountDense();
+  if (is_dense)
+    louds_dense_->getNodeLabels(node_num, node_labels, label_set);
+  else
+    louds_sparse_->getNodeLabels(node_num, node_labels, label_set);
+}
+
+template <typename Automaton, typename Visitor>
+void FST::intersect(const Automaton &automaton, Visitor &&visitor) const {
+  if (louds_sparse_->getNodeCount() == 0) return;
+  auto state = automaton.start();
+  if (automaton.isDead(state)) return;
+  std::string key;
+  intersectNode(automaton, state, 0, key, visitor);
+}
+
+template <typename Automaton, typename Visitor>
+void FST::intersectNode(const Automaton &automaton,
+                        const typename Automaton::State &state,
+                        const position_t node_num, std::string &key,
+                        Visitor &visitor) const {
+  word_t label_set[kLabelSetWords];
+  automaton.getLabelSet(state, label_set);
+  std::vector<NodeLabel> node_labels;
+  bool is_dense = false;
+  getNodeLabels(node_num, node_labels, is_dense, label_set);
+  for (const NodeLabel &node_label : node_labels) {
+    if (node_label.is_prefix_key) {  // the key ends here
+      visitor(key, getValue(is_dense, node_label.next),
+              automaton.isMatch(state));
+      continue;
+    }
+    auto next_state = automaton.step(state, node_label.label);
+    if (automaton.isDead(next_state)) continue;
+    key.push_back((char)node_label.label);
+    if (node_label.has_child) {
+      intersectNode(automaton, next_state, node_label.next, key, visitor);
+    } else {
+      visitor(key, getValue(is_dense, node_label.next),
+              automaton.isMatch(next_state));
+    }
+    key.pop_back();
+  }
+}
+
+template <typename Visitor>
+void FST::intersectKeys(const FST &a, const FST &b, Visitor &&visitor) {
+  if (a.louds_sparse_->getNodeCount() == 0 ||
+      b.louds_sparse_->getNodeCount() == 0)
+    return;
+  intersectNodes(a, 0, b, 0, 0, visitor);
+}
+
+template <typename Visitor>
+void FST::differenceKeys(const FST &a, const FST &b, Visitor &&visitor) {
+  if (a.louds_sparse_->getNodeCount() == 0) return;
+  if (b.louds_sparse_->getNodeCount() == 0) {
+    a.visitSubtree(0, visitor);
+    return;
+  }
+  differenceNodes(a, 0, b, 0, 0, visitor);
+}
+
+template <typename Visitor>
+void FST::intersectNodes(const FST &a, const position_t node_a, const FST &b,
+                         const position_t node_b, const level_t level,
+                         Visitor &visitor) {
+  word_t set_a[kLabelSetWords];
+  word_t set_b[kLabelSetWords];
+  a.getLabelSet(node_a, set_a);
+  b.getLabelSet(node_b, set_b);
+  // both lists hold the common labels, each preceded by its prefix key
+  std::vector<NodeLabel> labels_a, labels_b;
+  bool is_dense_a = false, is_dense_b = false;
+  a.getNodeLabels(node_a, labels_a, is_dense_a, set_b);
+  b.getNodeLabels(node_b, labels_b, is_dense_b, set_a);
+  size_t i = 0, j = 0;
+  bool has_prefix_a = !labels_a.empty() && labels_a[0].is_prefix_key;
+  bool has_prefix_b = !labels_b.empty() && labels_b[0].is_prefix_key;
+  if (has_prefix_a && has_prefix_b)  // prefix keys are stored whole
+    visitor(a.getValue(is_dense_a, labels_a[0].next),
+            b.getValue(is_dense_b, labels_b[0].next));
+  i += has_prefix_a;
+  j += has_prefix_b;
+  assert(labels_a.size() - i == labels_b.size() - j);
+  for (; i < labels_a.size(); i++, j++) {
+    const NodeLabel &label_a = labels_a[i];
+    const NodeLabel &label_b = labels_b[j];
+    assert(label_a.label == label_b.label);
+    if (label_a.has_child && label_b.has_child) {
+      intersectNodes(a, label_a.next, b, label_b.next, level + 1, visitor);
+    } else if (!label_a.has_child && !label_b.has_child) {
+      uint64_t value_a = a.getValue(is_dense_a, label_a.next);
+      uint64_t value_b = b.getValue(is_dense_b, label_b.next);
+      if (a.getOriginalKey(value_a) == b.getOriginalKey(value_b))
+        visitor(value_a, value_b);
+    } else if (!label_a.has_child) {
+      uint64_t value_a = a.getValue(is_dense_a, label_a.next);
+      uint64_t value_b = 0;
+      if (b.lookupOriginalKeyAtNode(a.getOriginalKey(value_a), level + 1,
+                                    label_b.next, value_b))
+        visitor(value_a, value_b);
+    } else {
+      uint64_t value_b = b.getValue(is_dense_b, label_b.next);
+      uint64_t value_a = 0;
+      if (a.lookupOriginalKeyAtNode(b.getOriginalKey(value_b), level + 1,
+                                    label_a.next, value_a))
+        visitor(value_a, value_b);
+    }
+  }
+}
+
+template <typename Visitor>
+void FST::differenceNodes(const FST &a, const position_t node_a, const FST &b,
+                          const position_t node_b, const level_t level,
+                          Visitor &visitor) {
+  word_t set_a[kLabelSetWords];
+  a.getLabelSet(node_a, set_a);
+  // labels_b holds the labels of b that a shares, in the same order
+  std::vector<NodeLabel> labels_a, labels_b;
+  bool is_dense_a = false, is_dense_b = false;
+  a.getNodeLabels(node_a, labels_a, is_dense_a);
+  b.getNodeLabels(node_b, labels_b, is_dense_b, set_a);
+  bool has_prefix_b = !labels_b.empty() && labels_b[0].is_prefix_key;
+  size_t j = has_prefix_b;
+  for (const NodeLabel &label_a : labels_a) {
+    if (label_a.is_prefix_key) {
+      if (!has_prefix_b) visitor(a.getValue(is_dense_a, label_a.next));
+      continue;
+    }
+    if (j == labels_b.size() || labels_b[j].label != label_a.label) {
+      if (label_a.has_child)
+        a.visitSubtree(label_a.next, visitor);
+      else
+        visitor(a.getValue(is_dense_a, label_a.next));
+      continue;
+    }
+    const NodeLabel &label_b = labels_b[j++];
+    if (label_a.has_child && label_b.has_child) {
+      differenceNodes(a, label_a.next, b, label_b.next, level + 1, visitor);
+    } else if (!label_a.has_child) {
+      uint64_t value_a = a.getValue(is_dense_a, label_a.next);
+      const std::string &key = a.getOriginalKey(value_a);
+      uint64_t value_b = 0;
+      bool is_in_b = label_b.has_child
+                         ? b.lookupOriginalKeyAtNode(key, level + 1,
+                                                     label_b.next, value_b)
+                         : b.getOriginalKey(b.getValue(
+                               is_dense_b, label_b.next)) == key;
+      if (!is_in_b) visitor(value_a);
+    } else {  // skip the one key of a that b's leaf may hold
+      uint64_t value_b = b.getValue(is_dense_b, label_b.next);
+      uint64_t skipped = 0;
+      bool is_in_a = a.lookupOriginalKeyAtNode(b.getOriginalKey(value_b),
+                                               level + 1, label_a.next,
+                                               skipped);
+      a.visitSubtree(label_a.next, [&](uint64_t value_a) {
+        if (!is_in_a || value_a != skipped) visitor(value_a);
+      });
+    }
+  }
+}
+
+template <typename Visitor>
+void FST::prefixSearch(const std::string &prefix, Visitor &&visitor) const {
+  if (louds_sparse_->getNodeCount() == 0) return;
+  position_t node_num = 0;
+  for (level_t level = 0; level < prefix.length(); level++) {
+    NodeLabel node_label;
+    bool is_dense = node_num < louds_sparse_->getNodeCountDense();
+    if (!(is_dense
+              ? louds_dense_->findLabel(node_num, prefix[level], node_label)
+              : louds_sparse_->findLabel(node_num, prefix[level], node_label)))
+      return;
+    if (!node_label.has_child)  // the stored key may continue with prefix
+      return visitor(getValue(is_dense, node_label.next),
+                     level + 1 == prefix.length());
+    node_num = node_label.next;
+  }
+  visitSubtree(node_num, [&](uint64_t value) { visitor(value, true); });
+}
+
+template <typename Visitor>
+void FST::visitSubtree(const position_t node_num, Visitor &&visitor) const {
+  std::vector<NodeLabel> node_labels;
+  bool is_dense = false;
+  getNodeLabels(node_num, node_labels, is_dense);
+  for (const NodeLabel &node_label : node_labels) {
+    if (node_label.has_child)
+      visitSubtree(node_label.next, visitor);
+    else
+      visitor(getValue(is_dense, node_label.next));
+  }
+}
+
+void FST::buildScores(const std::vector<uint64_t> &scores) {
+  std::vector<uint64_t> leaf_scores(louds_dense_->getNumValues() +
+                                    louds_sparse_->getNumValues());
+  assert(scores.size() == leaf_scores.size());
+  // the iterator visits the leaves in key order
+  uint64_t i = 0;
+  for (auto iter = moveToFirst(); iter.isValid() && i < scores.size();
+       iter++, i++) {
+    bool is_dense = iter.dense_iter_.isComplete();
+    position_t value_pos = is_dense ? iter.dense_iter_.getValuePos()
+                                    : iter.sparse_iter_.getValuePos();
+    leaf_scores[getLeafId(is_dense, value_pos)] = scores[i];
+  }
+
+  // children have larger node numbers than their parents
+  std::vector<uint64_t> node_max_scores(louds_sparse_->getNodeCount());
+  std::vector<NodeLabel> node_labels;
+  for (position_t node_num = node_max_scores.size(); node_num-- > 0;) {
+    bool is_dense = false;
+    node_labels.clear();
+    getNodeLabels(node_num, node_labels, is_dense);
+    uint64_t max_score = 0;
+    for (const NodeLabel &node_label : node_labels)
+      max_score = std::max(
+          max_score, node_label.has_child
+                         ? node_max_scores[node_label.next]
+                         : leaf_scores[getLeafId(is_dense, node_label.next)]);
+    node_max_scores[node_num] = max_score;
+  }
+  leaf_scores_ = std::make_unique<ValueVector>(leaf_scores);
+  node_max_scores_ = std::make_unique<ValueVector>(node_max_scores);
+}
+
+void FST::buildKeyCounts() {
+  // children have larger node numbers than their parents
+  std::vector<uint64_t> key_counts(louds_sparse_->getNodeCount(), 0);
+  std::vector<NodeLabel> node_labels;
+  for (position_t node_num = key_counts.size(); node_num-- > 0;) {
+    bool is_dense = false;
+    node_labels.clear();
+    getNodeLabels(node_num, node_labels, is_dense);
+    for (const NodeLabel &node_label : node_labels)
+      key_counts[node_num] +=
+          node_label.has_child ? key_counts[node_label.next] : 1;
+  }
+  key_count_sums_.assign(key_counts.size() + 1, 0);
+  std::partial_sum(key_counts.begin(), key_counts.end(),
+                   key_count_sums_.begin() + 1);
+}
+
+uint64_t FST::getRank(const FST::Iter &iter) const {
+  assert(hasKeyCounts());
+  if (!iter.isValid()) return getNumKeys();
+  uint64_t rank = 0;
+  const LoudsDense::Iter &dense_iter = iter.dense_iter_;
+  for (level_t level = 0; level < dense_iter.getPrefixLen(); level++) {
+    position_t pos = dense_iter.getPosInTrie(level);
+    rank += louds_dense_->countKeysBefore(louds_dense_->getNodeNum(pos), pos,
+                                          key_count_sums_);
+  }
+  // countKeysBefore counted the prefix key itself
+  if (dense_iter.isAtPrefixKey()) return rank - 1;
+  if (dense_iter.isComplete()) return rank;
+
+  const LoudsSparse::Iter &sparse_iter = iter.sparse_iter_;
+  level_t sparse_len = sparse_iter.getPrefixLen() - getSparseStartLevel();
+  for (level_t level = 0; level < sparse_len; level++) {
+    position_t pos = sparse_iter.getPosInTrie(level);
+    rank += louds_sparse_->countKeysBefore(louds_sparse_->getNodeNum(pos), pos,
+                                           key_count_sums_);
+  }
+  return rank;
+}
+
+std::vector<FST::RankedKey> FST::keysAtRanks(
+    const std::vector<uint64_t> &ranks) const {
+  assert(hasKeyCounts());
+  std::vector<RankedKey> results;
+  results.reserve(ranks.size());
+  if (getNumKeys() == 0) return results;
+
+  // nodes of the previous descent with the rank interval of their keys; the
+  // key holds one label per node below the root
+  struct PathNode {
+    position_t node_num;
+    uint64_t begin;
+    uint64_t end;
+  };
+  std::vector<PathNode> path;
+  std::string key;
+  for (uint64_t rank : ranks) {
+    assert(rank < getNumKeys());
+    while (!path.empty() &&
+           (rank < path.back().begin || rank >= path.back().end))
+      path.pop_back();
+    if (path.empty()) path.push_back({0, 0, getKeyCount(0)});
+    key.resize(path.size() - 1);
+
+    while (true) {
+      PathNode node = path.back();
+      uint64_t child_rank = rank - node.begin;
+      bool is_dense = node.node_num < louds_sparse_->getNodeCountDense();
+      NodeLabel node_label =
+          is_dense ? louds_dense_->findKeyLabel(node.node_num, child_rank,
+                                                key_count_sums_)
+                   : louds_sparse_->findKeyLabel(node.node_num, child_rank,
+                                                 key_count_sums_);
+      if (!node_label.is_prefix_key) key.push_back((char)node_label.label);
+      if (!node_label.has_child) {
+        results.push_back({rank, key, getValue(is_dense, node_label.next)});
+        break;
+      }
+      uint64_t begin = rank - child_rank;
+      path.push_back(
+          {node_label.next, begin, begin + getKeyCount(node_label.next)});
+    }
+  }
+  return results;
+}
+
+template <typename Rng>
+std::vector<FST::RankedKey> FST::sample(const std::string &left_key,
+                                        const std::string &right_key,
+                                        const size_t k, Rng &rng) const {
+  if (right_key < left_key) return {};
+  uint64_t begin = getBoundRank(left_key, true);
+  uint64_t end = getBoundRank(right_key, false);
+  if (begin >= end) return {};
+
+  std::uniform_int_distribution<uint64_t> distribution(begin, end - 1);
+  std::vector<uint64_t> ranks(k);
+  for (uint64_t &rank : ranks) rank = distribution(rng);
+  std::sort(ranks.begin(), ranks.end());
+  return keysAtRanks(ranks);
+}
+
+double FST::estimateRangeCount(const std::string &left_key,
+                               const std::string &right_key) const {
+  if (right_key < left_key) return 0;
+  return std::max(key_stats_->estimateRank(right_key) -
+                      key_stats_->estimateRank(left_key),
+                  0.0);
+}
+
+double FST::estimatePrefixCount(const std::string &prefix) const {
+  std::string successor = getPrefixSuccessor(prefix);
+  double end = successor.empty() ? key_stats_->getNumKeys()
+                                 : key_stats_->estimateRank(successor);
+  return std::max(end - key_stats_->estimateRank(prefix), 0.0);
+}
+
+uint64_t FST::getBoundRank(const std::string &key, const bool inclusive) const {
+  bool use_keys = louds_sparse_->getKeys() != nullptr;
+  FST::Iter iter = moveToKeyGreaterThan(key, inclusive, use_keys);
+  if (!key_stats_->valuesAreRanks()) return getRank(iter);
+  return iter.isValid() ? iter.getValue() : getNumKeys();
+}
+
+uint64_t FST::countRange(const std::string &left_key,
+                         const std::string &right_key) const {
+  if (right_key < left_key) return 0;
+  uint64_t begin = getBoundRank(left_key, true);
+  uint64_t end = getBoundRank(right_key, false);
+  return end > begin ? end - begin : 0;
+}
+
+uint64_t FST::countPrefix(const std::string &prefix) const {
+  std::string successor = getPrefixSuccessor(prefix);
+  uint64_t begin = getBoundRank(prefix, true);
+  uint64_t end =
+      successor.empty() ? getNumKeys() : getBoundRank(successor, true);
+  return end > begin ? end - begin : 0;
+}
+
+template <typename Visitor>
+void FST::forEachPrefix(const level_t len, Visitor &&visitor) const {
+  assert(hasKeyCounts());
+  if (getNumKeys() == 0) return;
+  std::string key;
+  if (len == 0) return visitor(key, (uint64_t)0, getNumKeys());
+  forEachPrefixNode(0, 0, len, 0, getNumKeys(), key, visitor);
+}
+
+template <typename Visitor>
+void FST::forEachPrefix(const level_t len, const std::string &left_key,
+                        const std::string &right_key,
+                        Visitor &&visitor) const {
+  assert(hasKeyCounts());
+  if (right_key < left_key) return;
+  uint64_t begin = getBoundRank(left_key, true);
+  uint64_t end = getBoundRank(right_key, false);
+  if (begin >= end) return;
+  std::string key;
+  if (len == 0) return visitor(key, begin, end);
+  forEachPrefixNode(0, 0, len, begin, end, key, visitor);
+}
+
+template <typename Visitor>
+void FST::forEachPrefixNode(const position_t node_num, uint64_t rank,
+                            const level_t len, const uint64_t begin,
+                            const uint64_t end, std::string &key,
+                            Visitor &visitor) const {
+  std::vector<NodeLabel> node_labels;
+  bool is_dense = false;
+  getNodeLabels(node_num, node_labels, is_dense);
+  for (const NodeLabel &node_label : node_labels) {
+    if (rank >= end) return;
+    uint64_t next_rank =
+        rank + (node_label.has_child ? getKeyCount(node_label.next) : 1);
+    if (next_rank <= begin) {  // before the range
+      rank = next_rank;
+      continue;
+    }
+    if (node_label.is_prefix_key) {  // the key ends here
+      visitor(key, rank, next_rank);
+      rank = next_rank;
+      continue;
+    }
+
+    key.push_back((char)node_label.label);
+    if (node_label.has_child && key.length() < len) {
+      forEachPrefixNode(node_label.next, rank, len, begin, end, key, visitor);
+    } else if (!node_label.has_child && key.length() < len &&
+               louds_sparse_->getKeys() != nullptr) {
+      const std::string &original_key =
+          getOriginalKey(getValue(is_dense, node_label.next));
+      visitor(original_key.substr(0, len), rank, next_rank);
+    } else {
+      visitor(key, std::max(rank, begin), std::min(next_rank, end));
+    }
+    key.pop_back();
+    rank = next_rank;
+  }
+}
+
+std::vector<FST::Completion> FST::topK(const std::string &prefix,
+                                       const size_t k) const {
+  assert(hasScores());
+  std::vector<Completion> completions;
+  if (k == 0) return completions;
+
+  // descend to the node below prefix
+  position_t node_num = 0;
+  for (level_t level = 0; level < prefix.size(); level++) {
+    bool is_dense = node_num < louds_sparse_->getNodeCountDense();
+    NodeLabel node_label;
+    if (!(is_dense
+              ? louds_dense_->findLabel(node_num, prefix[level], node_label)
+              : louds_sparse_->findLabel(node_num, prefix[level], node_label)))
+      return completions;
+    if (!node_label.has_child) {  // the only candidate
+      uint64_t value = getValue(is_dense, node_label.next);
+      completions.push_back(
+          {prefix.substr(0, level + 1), value,
+           leaf_scores_->read(getLeafId(is_dense, node_label.next))});
+      return completions;
+    }
+    node_num = node_label.next;
+  }
+
+  // best-first search, a candidate is a node (bounded by its subtree
+  // maximum) or a leaf (its score)
+  struct Candidate {
+    uint64_t score;
+    std::string key;
+    bool is_leaf;
+    bool is_dense;
+    position_t next;  // node number or leaf value position
+  };
+  auto lower_rank = [](const Candidate &a, const Candidate &b) {
+    if (a.score != b.score) return a.score < b.score;
+    return a.key > b.key;
+  };
+  std::priority_queue<Candidate, std::vector<Candidate>, decltype(lower_rank)>
+      candidates(lower_rank);
+  // the k best leaf scores pushed so far, smallest on top
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
+      best_scores;
+  auto push = [&](Candidate &&candidate) {
+    if (best_scores.size() == k && candidate.score < best_scores.top())
+      return;  // can not make it into the result
+    if (candidate.is_leaf) {
+      best_scores.push(candidate.score);
+      if (best_scores.size() > k) best_scores.pop();
+    }
+    candidates.push(std::move(candidate));
+  };
+
+  push({node_max_scores_->read(node_num), prefix, false, false, node_num});
+  std::vector<NodeLabel> node_labels;
+  while (!candidates.empty() && completions.size() < k) {
+    Candidate candidate = candidates.top();
+    candidates.pop();
+    if (candidate.is_leaf) {
+      uint64_t value = getValue(candidate.is_dense, candidate.next);
+      completions.push_back(
+          {std::move(candidate.key), value, candidate.score});
+      continue;
+    }
+    bool is_dense = false;
+    node_labels.clear();
+    getNodeLabels(candidate.next, node_labels, is_dense);
+    for (const NodeLabel &node_label : node_labels) {
+      std::string key = candidate.key;
+      if (!node_label.is_prefix_key) key.push_back((char)node_label.label);
+      if (node_label.has_child)
+        push({node_max_scores_->read(node_label.next), std::move(key), false,
+              is_dense, node_label.next});
+      else
+        push({leaf_scores_->read(getLeafId(is_dense, node_label.next)),
+              std::move(key), true, is_dense, node_label.next});
+    }
+  }
+  return completions;
+}
+
+FST::KeyBatch FST::decodeBatch(const std::vector<uint64_t> &values) const {
+  assert(hasReverseIndex());
+  KeyBatch batch;
+  batch.found.assign(values.size(), 0);
+  // (slot, index) pairs, slots are ordered like the keys for default values
+  std::vector<std::pair<uint64_t, uint64_t>> order;
+  order.reserve(values.size());
+  for (uint64_t i = 0; i < values.size(); i++) {
+    uint64_t slot = 0;
+    if (findReverseSlot(values[i], slot)) {
+      order.emplace_back(slot, i);
+      batch.found[i] = 1;
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  // decode in slot order into a scratch arena
+  std::string sorted_arena;
+  std::vector<uint64_t> sorted_offsets;
+  std::vector<uint64_t> lengths(values.size(), 0);
+  std::string key;
+  std::vector<position_t> ancestors;
+  for (auto &entry : order) {
+    uint64_t leaf = reverse_leaves_[entry.first];
+    decodeLeaf(leaf, key, ancestors);
+    sorted_offsets.push_back(sorted_arena.size());
+    sorted_arena.append(key);
+    appendRealSuffix(leaf, sorted_arena);
+    lengths[entry.second] = sorted_arena.size() - sorted_offsets.back();
+  }
+
+  // scatter back into the input order
+  batch.offsets.resize(values.size() + 1, 0);
+  for (uint64_t i = 0; i < values.size(); i++)
+    batch.offsets[i + 1] = batch.offsets[i] + lengths[i];
+  batch.arena.resize(batch.offsets.back());
+  for (uint64_t i = 0; i < order.size(); i++) {
+    uint64_t idx = order[i].second;
+    memcpy(&batch.arena[batch.offsets[idx]], &sorted_arena[sorted_offsets[i]],
+           lengths[idx]);
+  }
+  return batch;
+}
+
 uint64_t FST::lookupNodeNum(const char *key, uint64_t key_length) const {
   position_t node_num = 0;
   if (louds_dense_->lookupNodeNumber(key, key_length, node_num))
@@ -235,6 +1885,8 @@ uint64_t FST::lookupNodeNum(const char *key, uint64_t key_length) const {
 inline bool FST::lookupKeyAtNode(const char *key, uint64_t key_length,
                                  level_t level, size_t node_number,
                                  uint64_t &value) const {
+  if (bloom_filter_ && !bloom_filter_->mayContain(key, key_length))
+    return false;
   if (level < getSparseStartLevel()) {  // start lookup in LoudsDense
     if (!louds_dense_->lookupKeyAtNode(key, key_length, level, node_number,
                                        value)) {
@@ -262,6 +1914,110 @@ inline bool FST::amacLookup(const char keyByte, level_t level,
   }
 }
 
+bool FST::lookupKeyWithLevel(const std::string &key, uint64_t &value,
+                             level_t &leaf_level) const {
+  if (bloom_filter_ && !bloom_filter_->mayContain(key)) return false;
+  size_t node_number = 0;
+  for (level_t level = 0; level < key.length(); level++) {
+    if (!amacLookup(key[level], level, node_number)) return false;
+    if ((node_number & 3u) == 1u) {  // branch terminates
+      value = node_number >> 2u;
+      leaf_level = level;
+      return true;
+    }
+    node_number >>= 2u;
+  }
+  // run out of key bytes, the key may end at this node
+  leaf_level = key.length();
+  return getPrefixKeyValue(node_number, value);
+}
+
+FST::FalsePositiveStats FST::estimateFalsePositives(
+    const std::vector<std::string> &keys,
+    const std::vector<std::string> &negative_keys,
+    const double target_rate) const {
+  FalsePositiveStats stats;
+  stats.false_positives_per_level.resize(getHeight(), 0);
+  // per false positive: number of key bits following the trie path that
+  // agree with the query, i.e., real suffix bits that could not reject it
+  std::vector<uint32_t> matching_suffix_bits;
+
+  for (const auto &key : negative_keys) {
+    uint64_t value = 0;
+    level_t leaf_level = 0;
+    if (!lookupKeyWithLevel(key, value, leaf_level)) {
+      stats.num_queries++;
+      stats.num_true_negatives++;
+      continue;
+    }
+    const std::string &stored_key = keys[value];
+    if (stored_key == key) {
+      stats.num_positives_skipped++;
+      continue;
+    }
+    stats.num_queries++;
+    stats.num_false_positives++;
+    stats.false_positives_per_level[leaf_level]++;
+
+    // real suffixes are zero padded past the end of the key, so a key that
+    // ends is still told apart from a longer one by a nonzero byte; 64
+    // matching bits means no real suffix can
+    uint32_t matching_bits = 0;
+    for (size_t i = leaf_level + 1; matching_bits < 64; i++) {
+      uint8_t stored_byte =
+          i < stored_key.length() ? (uint8_t)stored_key[i] : (uint8_t)0;
+      uint8_t byte = i < key.length() ? (uint8_t)key[i] : (uint8_t)0;
+      uint8_t diff = stored_byte ^ byte;
+      if (diff != 0) {
+        matching_bits += __builtin_clz(diff) - 24;
+        break;
+      }
+      matching_bits += 8;
+    }
+    matching_suffix_bits.push_back(matching_bits);
+  }
+  if (stats.num_queries == 0) return stats;
+
+  stats.false_positive_rate =
+      (double)stats.num_false_positives / (double)stats.num_queries;
+  if (stats.false_positive_rate > target_rate && target_rate > 0) {
+    // every hashed bit halves the remaining false positives
+    stats.fingerprint_bits = (uint32_t)std::ceil(
+        std::log2(stats.false_positive_rate / target_rate));
+  }
+
+  // smallest number of real suffix bits that rejects enough false positives
+  std::sort(matching_suffix_bits.begin(), matching_suffix_bits.end());
+  const auto max_false_positives =
+      (uint64_t)(target_rate * (double)stats.num_queries);
+  uint64_t remaining = matching_suffix_bits.size();
+  for (uint32_t bits = 0; bits <= 64; bits++) {
+    remaining = matching_suffix_bits.end() -
+                std::lower_bound(matching_suffix_bits.begin(),
+                                 matching_suffix_bits.end(), bits);
+    stats.real_suffix_bits = bits;
+    if (remaining <= max_false_positives) break;
+  }
+  stats.real_suffix_rate = (double)remaining / (double)stats.num_queries;
+  return stats;
+}
+
+FST::FalsePositiveStats FST::estimateFalsePositives(
+    const std::vector<std::string> &keys, const uint64_t num_samples,
+    const double target_rate, const uint64_t seed) const {
+  std::mt19937_64 rng(seed);
+  std::vector<std::string> negative_keys;
+  negative_keys.reserve(num_samples);
+  for (uint64_t i = 0; i < num_samples; i++) {
+    std::string key = keys[rng() % keys.size()];
+    if (key.empty()) continue;
+    for (size_t pos = rng() % key.length(); pos < key.length(); pos++)
+      key[pos] = (char)(rng() & 0xFF);
+    negative_keys.push_back(std::move(key));
+  }
+  return estimateFalsePositives(keys, negative_keys, target_rate);
+}
+
 /// For the given node_number, this function returns the first node that is a
 /// leaf node or has at least two branches
 /// It recursively goes down if a node has only one label and stores these
@@ -289,42 +2045,166 @@ void FST::getNode(level_t level, size_t node_number,
 
 FST::Iter FST::moveToKeyGreaterThan(const std::string &key,
                                     const bool inclusive) const {
+  return moveToKeyGreaterThan(key, inclusive, true);
+}
+
+FST::Iter FST::moveToKeyGreaterThan(const std::string &key,
+                                    const bool inclusive,
+                                    const bool use_keys) const {
   FST::Iter iter(this);
-  // todo do not move iterator,
-  louds_dense_->moveToKeyGreaterThan(key, inclusive, iter.dense_iter_);
+  moveToKeyGreaterThan(key, inclusive, use_keys, 0, iter);
+  return iter;
+}
 
-  if (!iter.dense_iter_.isValid()) return iter;
-  if (iter.dense_iter_.isComplete()) return iter;
+void FST::moveToKeyGreaterThan(const std::string &key, const bool inclusive,
+                               const bool use_keys, const level_t level,
+                               FST::Iter &iter) const {
+  if (level >= getSparseStartLevel() && level > 0) {  // dense path stays
+    louds_sparse_->moveToKeyGreaterThan(key, inclusive, iter.sparse_iter_,
+                                        use_keys, level);
+    if (!iter.sparse_iter_.isValid()) iter.incrementDenseIter();
+    return;
+  }
+
+  // sparse leaves may be skipped below any dense path
+  iter.sparse_iter_.resumeAt(getSparseStartLevel());
+  louds_dense_->moveToKeyGreaterThan(key, inclusive, iter.dense_iter_,
+                                     use_keys, level);
+
+  if (!iter.dense_iter_.isValid()) return;
+  if (iter.dense_iter_.isComplete()) return;
 
   if (!iter.dense_iter_.isSearchComplete()) {
     iter.passToSparse();
-    louds_sparse_->moveToKeyGreaterThan(key, inclusive, iter.sparse_iter_);
+    louds_sparse_->moveToKeyGreaterThan(key, inclusive, iter.sparse_iter_,
+                                        use_keys);
     if (!iter.sparse_iter_.isValid()) iter.incrementDenseIter();
-    return iter;
+    return;
   } else if (!iter.dense_iter_.isMoveLeftComplete()) {
     iter.passToSparse();
     iter.sparse_iter_.moveToLeftMostKey();
-    return iter;
+    return;
   }
 
   assert(false);  // shouldn't reach here
-  return iter;
 }
 
-FST::Iter FST::moveToKeyLessThan(const std::string &key) const {
-  FST::Iter iter = moveToKeyGreaterThan(key, false);
-  if (!iter.isValid()) {
-    iter = moveToLast();
+FST::Iter FST::moveToKeyLessThan(const std::string &key,
+                                 const bool inclusive) const {
+  FST::Iter iter(this);
+  bool use_keys = louds_sparse_->getKeys() != nullptr;
+  louds_dense_->moveToKeyLessThan(key, inclusive, iter.dense_iter_, use_keys);
+
+  if (!iter.dense_iter_.isValid()) return iter;
+  if (iter.dense_iter_.isComplete()) return iter;
+
+  if (!iter.dense_iter_.isSearchComplete()) {
+    iter.passToSparse();
+    louds_sparse_->moveToKeyLessThan(key, inclusive, iter.sparse_iter_,
+                                     use_keys);
+    if (!iter.sparse_iter_.isValid()) iter.decrementDenseIter();
+    return iter;
+  } else if (!iter.dense_iter_.isMoveRightComplete()) {
+    iter.passToSparse();
+    iter.sparse_iter_.moveToRightMostKey();
     return iter;
   }
-  // if (!iter.getFpFlag()) {
-  //  iter--;
-  //  uint64_t value = 0;
-  //  if (lookupKey(key, value)) iter--;
-  //}
+
+  assert(false);  // shouldn't reach here
   return iter;
 }
 
+std::vector<FST::Iter> FST::seekBatch(
+    const std::vector<std::string_view> &keys, const bool inclusive) const {
+  // Walk state of one key. A sparse level takes two rounds: the node's first
+  // label position (its select sample prefetched the round before), then
+  // the label search (labels prefetched). A dense level takes one round.
+  struct Walk {
+    position_t node_num;
+    level_t level;
+    bool is_walking;
+    bool has_labels;
+  };
+  level_t sparse_start_level = getSparseStartLevel();
+  std::vector<FST::Iter> iters;
+  iters.reserve(keys.size());
+  for (uint64_t begin = 0; begin < keys.size(); begin += kSeekBatchWindow) {
+    uint64_t end = std::min<uint64_t>(begin + kSeekBatchWindow, keys.size());
+    Walk walks[kSeekBatchWindow];
+    for (uint64_t i = begin; i < end; i++) {
+      walks[i - begin] = {0, 0, !keys[i].empty(), false};
+      iters.emplace_back(this);
+      if (sparse_start_level == 0) {
+        iters[i].dense_iter_.setToSparseRoot();
+        iters[i].passToSparse();
+      }
+    }
+    for (uint64_t num_walking = end - begin; num_walking > 0;) {
+      num_walking = 0;
+      for (uint64_t i = begin; i < end; i++) {
+        Walk &walk = walks[i - begin];
+        if (!walk.is_walking) continue;
+        num_walking++;
+        label_t label = (label_t)keys[i][walk.level];
+        bool is_dense = walk.level < sparse_start_level;
+        if (!is_dense && !walk.has_labels) {
+          louds_sparse_->prefetchLabels(walk.node_num);
+          walk.has_labels = true;
+          continue;
+        }
+        if (is_dense ? !louds_dense_->walkLabel(label, walk.node_num,
+                                                 iters[i].dense_iter_)
+                     : !louds_sparse_->walkLabel(label, walk.node_num,
+                                                  iters[i].sparse_iter_)) {
+          walk.is_walking = false;  // missing label or leaf
+          continue;
+        }
+        walk.level++;
+        walk.has_labels = false;
+        if (walk.level == sparse_start_level) iters[i].passToSparse();
+        if (walk.level == keys[i].size()) {
+          walk.is_walking = false;
+        } else if (walk.level < sparse_start_level) {
+          louds_dense_->prefetchLabel(walk.node_num,
+                                      (label_t)keys[i][walk.level]);
+        } else {
+          louds_sparse_->prefetchNode(walk.node_num);
+        }
+      }
+    }
+    // finish each seek below its exact-match path
+    for (uint64_t i = begin; i < end; i++)
+      moveToKeyGreaterThan(std::string(keys[i]), inclusive, true,
+                           walks[i - begin].level, iters[i]);
+  }
+  return iters;
+}
+
+bool FST::mayContainRange(const std::string &left_key,
+                          const std::string &right_key) const {
+  if (right_key < left_key) return false;
+  if (left_key == right_key && bloom_filter_ &&
+      !bloom_filter_->mayContain(left_key))
+    return false;
+  // smallest leaf that may hold a key >= left_key
+  FST::Iter iter = moveToKeyGreaterThan(left_key, true, false);
+  if (!iter.isValid()) return false;
+  int compare = iter.compare(right_key);
+  if (compare != 0) return compare < 0;
+
+  // the leaf's trie path is a prefix of right_key, consult its suffix
+  bool is_dense = iter.dense_iter_.isComplete();
+  const BitvectorSuffix &suffixes = is_dense ? louds_dense_->getSuffixes()
+                                             : louds_sparse_->getSuffixes();
+  position_t value_pos = is_dense ? iter.dense_iter_.getValuePos()
+                                  : iter.sparse_iter_.getValuePos();
+  level_t prefix_len = is_dense ? iter.dense_iter_.getPrefixLen()
+                                : iter.sparse_iter_.getPrefixLen();
+  if (left_key == right_key)
+    return suffixes.checkEquality(value_pos, right_key, prefix_len);
+  return suffixes.compare(value_pos, right_key, prefix_len) <= 0;
+}
+
 FST::Iter FST::moveToFirst() const {
   FST::Iter iter(this);
   if (louds_dense_->getHeight() > 0) {
@@ -334,6 +2214,7 @@ FST::Iter FST::moveToFirst() const {
     iter.passToSparse();
     iter.sparse_iter_.moveToLeftMostKey();
   } else {
+    iter.dense_iter_.setToSparseRoot();
     iter.sparse_iter_.setToFirstLabelInRoot();
     iter.sparse_iter_.moveToLeftMostKey();
   }
@@ -349,12 +2230,33 @@ FST::Iter FST::moveToLast() const {
     iter.passToSparse();
     iter.sparse_iter_.moveToRightMostKey();
   } else {
+    iter.dense_iter_.setToSparseRoot();
     iter.sparse_iter_.setToLastLabelInRoot();
     iter.sparse_iter_.moveToRightMostKey();
   }
   return iter;
 }
 
+bool FST::resume(const std::string &token, FST::Iter &iter) const {
+  // the path vectors of an iterator over this FST are reused
+  if (iter.fst_ == this)
+    iter.clear();
+  else
+    iter = FST::Iter(this);
+  if (token.size() < 1 + sizeof(uint64_t) || token[0] != kTokenFormat)
+    return false;
+  uint64_t stamp;
+  memcpy(&stamp, token.data() + 1, sizeof(stamp));
+  if (stamp != build_stamp_) return false;
+
+  const char *src = token.data() + 1 + sizeof(stamp);
+  const char *end = token.data() + token.size();
+  if (src == end) return true;  // saved at the end of the scan
+  if (iter.restorePath(src, end) && src == end) return true;
+  iter.clear();
+  return false;
+}
+
 std::pair<FST::Iter, FST::Iter> FST::lookupRange(const std::string &left_key,
                                                  const bool left_inclusive,
                                                  const std::string &right_key,
@@ -385,12 +2287,24 @@ std::pair<FST::Iter, FST::Iter> FST::lookupRange(const std::string &left_key,
 }
 
 uint64_t FST::serializedSize() const {
-  return (louds_dense_->serializedSize() + louds_sparse_->serializedSize());
+  return (kSerialHeaderSize + louds_dense_->serializedSize() +
+          louds_sparse_->serializedSize() +
+          (bloom_filter_ ? bloom_filter_->serializedSize()
+                         : BlockedBloomFilter().serializedSize()) +
+          (leaf_scores_ ? leaf_scores_->serializedSize() +
+                              node_max_scores_->serializedSize()
+                        : 2 * ValueVector().serializedSize()) +
+          sizeof(build_stamp_) + key_stats_->serializedSize());
 }
 
 uint64_t FST::getMemoryUsage() const {
   return (sizeof(FST) + louds_dense_->getMemoryUsage() +
-          louds_sparse_->getMemoryUsage());
+          louds_sparse_->getMemoryUsage() +
+          (bloom_filter_ ? bloom_filter_->size() : 0) +
+          (reverse_leaves_.size() + reverse_values_.size()) * 8 +
+          (leaf_scores_ ? leaf_scores_->size() + node_max_scores_->size()
+                        : 0) +
+          key_count_sums_.size() * 8 + key_stats_->size());
 }
 
 level_t FST::getHeight() const { return louds_sparse_->getHeight(); }
@@ -399,6 +2313,32 @@ level_t FST::getSparseStartLevel() const {
   return louds_sparse_->getStartLevel();
 }
 
+std::vector<LevelStats> FST::getLevelStats() const {
+  std::vector<LevelStats> stats;
+  louds_dense_->getLevelStats(stats);
+  louds_sparse_->getLevelStats(stats);
+  return stats;
+}
+
+std::vector<std::pair<std::string, uint64_t>> FST::getMemoryBreakdown() const {
+  std::vector<std::pair<std::string, uint64_t>> components;
+  louds_dense_->getMemoryBreakdown(components);
+  louds_sparse_->getMemoryBreakdown(components);
+  if (bloom_filter_)
+    components.emplace_back("bloom filter", bloom_filter_->size());
+  if (hasScores())
+    components.emplace_back(
+        "scores", leaf_scores_->size() + node_max_scores_->size());
+  if (hasReverseIndex())
+    components.emplace_back(
+        "reverse index",
+        (reverse_leaves_.size() + reverse_values_.size()) * 8);
+  if (hasKeyCounts())
+    components.emplace_back("key counts", key_count_sums_.size() * 8);
+  components.emplace_back("key statistics", key_stats_->size());
+  return components;
+}
+
 //============================================================================
 
 void FST::Iter::clear() {
@@ -481,6 +2421,36 @@ bool FST::Iter::operator--(int) {
   return decrementDenseIter();
 }
 
+bool FST::Iter::skipTo(const std::string &key) {
+  if (!isValid()) return false;
+  int compare = this->compare(key);
+  if (compare > 0) return true;
+  level_t level = dense_iter_.getResumeLevel(key);
+  if (!dense_iter_.isComplete() && level == fst_->getSparseStartLevel())
+    level = sparse_iter_.getResumeLevel(key);
+  fst_->moveToKeyGreaterThan(key, true,
+                             fst_->louds_sparse_->getKeys() != nullptr,
+                             level, *this);
+  return isValid();
+}
+
+std::string FST::Iter::saveToken() const {
+  std::string token(1, kTokenFormat);
+  uint64_t stamp = fst_->build_stamp_;
+  token.append(reinterpret_cast<const char *>(&stamp), sizeof(stamp));
+  if (!isValid()) return token;
+  dense_iter_.savePath(token);
+  if (!dense_iter_.isComplete()) sparse_iter_.savePath(token);
+  return token;
+}
+
+bool FST::Iter::restorePath(const char *&src, const char *end) {
+  if (!dense_iter_.restorePath(src, end)) return false;
+  if (dense_iter_.isComplete()) return true;
+  passToSparse();
+  return sparse_iter_.restorePath(src, end);
+}
+
 bool FST::Iter::operator!=(const FST::Iter &other) {
   // compare two iterators
 
@@ -509,6 +2479,339 @@ bool FST::Iter::operator!=(const FST::Iter &other) {
   return this->sparse_iter_.getLastIteratorPosition() !=
          other.sparse_iter_.getLastIteratorPosition();
 }
+
+//============================================================================
+
+void FST::PrefixCursor::reset() {
+  path_.assign(1, {true, true, 0, 0});
+  prefix_.clear();
+}
+
+bool FST::PrefixCursor::extend(const char byte) {
+  // every step carries its rank, see range
+  assert(fst_->hasKeyCounts());
+  if (fst_->louds_sparse_->getNodeCount() == 0) return false;
+  Step step = path_.back();
+  if (!step.has_child) {  // past a leaf
+    if (fst_->louds_sparse_->getKeys() != nullptr) {
+      const std::string &key =
+          fst_->getOriginalKey(fst_->getValue(step.is_dense, step.next));
+      if (key.length() <= prefix_.length() || key[prefix_.length()] != byte)
+        return false;
+    }
+  } else {
+    position_t node_num = step.next;
+    step.is_dense = node_num < fst_->louds_sparse_->getNodeCountDense();
+    NodeLabel node_label;
+    position_t pos = 0;
+    if (!(step.is_dense ? fst_->louds_dense_->findLabel(node_num, byte,
+                                                        node_label, &pos)
+                        : fst_->louds_sparse_->findLabel(node_num, byte,
+                                                         node_label, &pos)))
+      return false;
+    step.begin += step.is_dense ? fst_->louds_dense_->countKeysBefore(
+                                      node_num, pos, fst_->key_count_sums_)
+                                : fst_->louds_sparse_->countKeysBefore(
+                                      node_num, pos, fst_->key_count_sums_);
+    step.has_child = node_label.has_child;
+    step.next = node_label.next;
+  }
+  path_.push_back(step);
+  prefix_.push_back(byte);
+  return true;
+}
+
+bool FST::PrefixCursor::retract() {
+  if (prefix_.empty()) return false;
+  path_.pop_back();
+  prefix_.pop_back();
+  return true;
+}
+
+std::pair<uint64_t, uint64_t> FST::PrefixCursor::range() const {
+  assert(fst_->hasKeyCounts());
+  if (fst_->louds_sparse_->getNodeCount() == 0) return {0, 0};
+  const Step &step = path_.back();
+  return {step.begin,
+          step.begin + (step.has_child ? fst_->getKeyCount(step.next) : 1)};
+}
+
+std::vector<label_t> FST::PrefixCursor::children() const {
+  std::vector<label_t> labels;
+  if (fst_->louds_sparse_->getNodeCount() == 0) return labels;
+  const Step &step = path_.back();
+  if (!step.has_child) {  // the next byte of the leaf's key, if known
+    if (fst_->louds_sparse_->getKeys() != nullptr) {
+      const std::string &key =
+          fst_->getOriginalKey(fst_->getValue(step.is_dense, step.next));
+      if (key.length() > prefix_.length())
+        labels.push_back((label_t)key[prefix_.length()]);
+    }
+    return labels;
+  }
+  std::vector<NodeLabel> node_labels;
+  bool is_dense = false;
+  fst_->getNodeLabels(step.next, node_labels, is_dense);
+  for (const NodeLabel &node_label : node_labels)
+    if (!node_label.is_prefix_key) labels.push_back(node_label.label);
+  return labels;
+}
+
+bool FST::PrefixCursor::isExact() const {
+  return fst_->louds_sparse_->getKeys() != nullptr || path_.size() < 2 ||
+         path_[path_.size() - 2].has_child;
+}
+
+//============================================================================
+
+SuffixIndex::SuffixIndex(const std::vector<std::string> &keys,
+                         const std::vector<uint64_t> *values,
+                         const bool include_dense,
+                         const uint32_t sparse_dense_ratio) {
+  // (reversed key, value) pairs; a duplicate key keeps its first value, as
+  // in the forward FST
+  std::vector<std::pair<std::string, uint64_t>> entries;
+  entries.reserve(keys.size());
+  for (uint64_t i = 0; i < keys.size(); i++)
+    entries.emplace_back(std::string(keys[i].rbegin(), keys[i].rend()),
+                         values ? (*values)[i] : i);
+  // stable and by key only, so duplicates stay in input order
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const std::pair<std::string, uint64_t> &a,
+                      const std::pair<std::string, uint64_t> &b) {
+                     return a.first < b.first;
+                   });
+
+  std::vector<std::string> reversed_keys;
+  std::vector<uint64_t> reversed_values;
+  reversed_keys.reserve(entries.size());
+  reversed_values.reserve(entries.size());
+  for (auto &entry : entries) {
+    reversed_keys.push_back(std::move(entry.first));
+    reversed_values.push_back(entry.second);
+  }
+  entries = {};
+  reversed_ = std::make_unique<FST>(reversed_keys, reversed_values,
+                                    include_dense, sparse_dense_ratio);
+}
+
+std::vector<uint64_t> SuffixIndex::suffixRange(
+    const std::string &suffix) const {
+  std::vector<uint64_t> values;
+  reversed_->prefixSearch(
+      std::string(suffix.rbegin(), suffix.rend()),
+      [&](uint64_t value, bool is_exact) {
+        if (!is_exact && keys_ != nullptr) {
+          const std::string &key = (*keys_)[value];
+          if (key.length() < suffix.length() ||
+              key.compare(key.length() - suffix.length(), suffix.length(),
+                          suffix) != 0)
+            return;
+        }
+        values.push_back(value);
+      });
+  return values;
+}
+
+BlockIndex::BlockIndex(const std::vector<std::string> &keys,
+                       const std::vector<uint64_t> &blocks,
+                       const bool include_dense,
+                       const uint32_t sparse_dense_ratio) {
+  assert(!keys.empty() && keys.size() == blocks.size());
+  std::vector<uint64_t> block_numbers;
+  // a lone first byte precedes the whole first block
+  separators_.push_back(keys[0].substr(0, 1));
+  block_numbers.push_back(blocks[0]);
+  for (uint64_t i = 1; i < keys.size(); i++) {
+    if (blocks[i] == blocks[i - 1]) continue;
+    assert(blocks[i] > blocks[i - 1] && keys[i - 1] < keys[i]);
+    const std::string &last = keys[i - 1], &first = keys[i];
+    size_t common = 0;
+    while (common < last.length() && last[common] == first[common]) common++;
+    separators_.push_back(first.substr(0, common + 1));
+    block_numbers.push_back(blocks[i]);
+  }
+  block_numbers_ = std::make_unique<ValueVector>(block_numbers);
+  fst_ = std::make_unique<FST>(separators_, include_dense, sparse_dense_ratio);
+  fst_->setKeys(separators_);
+}
+
+bool BlockIndex::lookupBlock(const std::string &key, uint64_t &block) const {
+  FST::Iter iter = fst_->moveToKeyLessThan(key, true);
+  if (!iter.isValid()) return false;
+  block = block_numbers_->read(iter.getValue());
+  return true;
+}
+
+bool BlockIndex::lookupBlockRange(const std::string &left_key,
+                                  const std::string &right_key,
+                                  uint64_t &first_block,
+                                  uint64_t &last_block) const {
+  if (right_key < left_key || !lookupBlock(right_key, last_block))
+    return false;
+  // keys before the first separator start in the first block
+  if (!lookupBlock(left_key, first_block))
+    first_block = block_numbers_->read(0);
+  return true;
+}
+
+uint64_t BlockIndex::serializedSize() const {
+  uint64_t size = sizeof(uint64_t);
+  for (const std::string &separator : separators_)
+    size += sizeof(uint32_t) + separator.length();
+  sizeAlign(size);
+  return fst_->serializedSize() + size + block_numbers_->serializedSize();
+}
+
+uint64_t BlockIndex::getMemoryUsage() const {
+  uint64_t size = sizeof(BlockIndex) + fst_->getMemoryUsage() +
+                  block_numbers_->size() +
+                  separators_.capacity() * sizeof(std::string);
+  for (const std::string &separator : separators_)
+    if (separator.capacity() > 15) size += separator.capacity() + 1;
+  return size;
+}
+
+char *BlockIndex::serialize() const {
+  uint64_t size = serializedSize();
+  // zeroed padding, see FST::serialize
+  char *data = new char[size]();
+  char *cur_data = data;
+  BufferWriter out(cur_data);
+  serialize(out);
+  assert(cur_data - data == (int64_t)size);
+  return data;
+}
+
+bool BlockIndex::serializeTo(const int fd, const bool sync) const {
+  FileWriter out(fd);
+  serialize(out);
+  return out.finish(sync);
+}
+
+template <typename Writer>
+void BlockIndex::serialize(Writer &out) const {
+  fst_->serialize(out);
+  uint64_t num_separators = separators_.size();
+  out.write(&num_separators, sizeof(num_separators));
+  for (const std::string &separator : separators_) {
+    uint32_t length = separator.length();
+    out.write(&length, sizeof(length));
+    out.write(separator.data(), length);
+  }
+  out.align();
+  block_numbers_->serialize(out);
+}
+
+BlockIndex *BlockIndex::deSerialize(char *src) {
+  BlockIndex *index = new BlockIndex();
+  index->fst_.reset(FST::deSerialize(src));
+  src += index->fst_->serializedSize();
+  uint64_t num_separators = 0;
+  memcpy(&num_separators, src, sizeof(num_separators));
+  src += sizeof(num_separators);
+  index->separators_.reserve(num_separators);
+  for (uint64_t i = 0; i < num_separators; i++) {
+    uint32_t length = 0;
+    memcpy(&length, src, sizeof(length));
+    src += sizeof(length);
+    index->separators_.emplace_back(src, length);
+    src += length;
+  }
+  align(src);
+  index->block_numbers_ = ValueVector::deSerialize(src);
+  index->fst_->setKeys(index->separators_);
+  return index;
+}
+
+MergingIter::MergingIter(const std::vector<const FST *> &sources)
+    : sources_(sources),
+      iters_(sources.size()),
+      keys_(sources.size()),
+      tree_(std::max<size_t>(sources.size(), 1), 0) {}
+
+void MergingIter::seek(const std::string &key, const bool inclusive) {
+  for (size_t i = 0; i < sources_.size(); i++) {
+    const FST *fst = sources_[i];
+    iters_[i] = fst->moveToKeyGreaterThan(
+        key, inclusive, fst->louds_sparse_->getKeys() != nullptr);
+    loadKey(i);
+  }
+  if (!sources_.empty()) tree_[0] = build(1);
+}
+
+void MergingIter::seekToFirst() {
+  for (size_t i = 0; i < sources_.size(); i++) {
+    iters_[i] = sources_[i]->moveToFirst();
+    loadKey(i);
+  }
+  if (!sources_.empty()) tree_[0] = build(1);
+}
+
+bool MergingIter::isValid() const {
+  return !sources_.empty() && iters_[tree_[0]].isValid();
+}
+
+size_t MergingIter::getSource() const {
+  assert(isValid());
+  return tree_[0];
+}
+
+uint64_t MergingIter::getValue() const {
+  assert(isValid());
+  return iters_[tree_[0]].getValue();
+}
+
+std::string MergingIter::getKey() const {
+  assert(isValid());
+  return iters_[tree_[0]].getKey();
+}
+
+bool MergingIter::operator++(int) {
+  if (!isValid()) return false;
+  size_t source = tree_[0];
+  iters_[source]++;
+  loadKey(source);
+  replay(source);
+  return isValid();
+}
+
+bool MergingIter::isBefore(const size_t a, const size_t b) const {
+  if (!iters_[a].isValid()) return false;
+  if (!iters_[b].isValid()) return true;
+  const std::string &key_a =
+      sources_[a]->louds_sparse_->getKeys() != nullptr
+          ? sources_[a]->getOriginalKey(iters_[a].getValue())
+          : keys_[a];
+  const std::string &key_b =
+      sources_[b]->louds_sparse_->getKeys() != nullptr
+          ? sources_[b]->getOriginalKey(iters_[b].getValue())
+          : keys_[b];
+  int compare = key_a.compare(key_b);
+  return compare < 0 || (compare == 0 && a < b);
+}
+
+void MergingIter::loadKey(const size_t source) {
+  if (sources_[source]->louds_sparse_->getKeys() == nullptr)
+    keys_[source] = iters_[source].getKey();
+}
+
+size_t MergingIter::build(const size_t node) {
+  if (node >= sources_.size()) return node - sources_.size();
+  size_t left = build(2 * node);
+  size_t right = build(2 * node + 1);
+  if (isBefore(right, left)) std::swap(left, right);
+  tree_[node] = right;
+  return left;
+}
+
+void MergingIter::replay(const size_t source) {
+  size_t winner = source;
+  for (size_t node = (sources_.size() + source) / 2; node > 0; node /= 2) {
+    if (isBefore(tree_[node], winner)) std::swap(tree_[node], winner);
+  }
+  tree_[0] = winner;
+}
 }  // namespace mmphf_fst
 
 #endif  // SURF_H
@@ -0,0 +1,366 @@
+// Command line tool to build, inspect, query and convert serialized FSTs.
+//
+//   fst_tool build   <key_file> -o <fst_file> [--sorted] [--threads N]
+//                    [--no-dense] [--ratio R] [--bloom-bits B]
+//                    [--suffix hash|real] [--suffix-bits N] [--hex]
+//   fst_tool inspect <fst_file>
+//   fst_tool query   <fst_file> <query_file> [--keys <key_file>] [--hex]
+//   fst_tool convert <fst_file> -o <fst_file> [--no-dense] [--ratio R]
+//                    [--bloom-bits B --keys <key_file>] [--hex]
+//   fst_tool fprate  <fst_file> --keys <key_file> [<negative_key_file>]
+//                    [--samples N] [--target RATE] [--hex]
+//
+// Key and query files contain one key per line (hex encoded with --hex).
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+#include <mmphf_fst.hpp>
+
+#include "tool_common.hpp"
+
+using namespace mmphf_fst;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  std::vector<std::string> positional;
+  std::string output_path;
+  std::string key_path;
+  bool hex = false;
+  bool sorted = false;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  bool include_dense = kIncludeDense;
+  uint32_t sparse_dense_ratio = kSparseDenseRatio;
+  uint32_t bloom_bits_per_key = 0;
+  SuffixType suffix_type = kNone;
+  level_t suffix_len = 0;
+  uint64_t samples = 1000000;
+  double target_rate = 0.01;
+};
+
+void usage() {
+  std::cerr
+      << "usage: fst_tool build   <key_file> -o <fst_file> [--sorted]\n"
+         "                        [--threads N] [--no-dense] [--ratio R]\n"
+         "                        [--bloom-bits B] [--suffix hash|real]\n"
+         "                        [--suffix-bits N] [--hex]\n"
+         "       fst_tool inspect <fst_file>\n"
+         "       fst_tool query   <fst_file> <query_file> [--keys <file>]\n"
+         "                        [--hex]\n"
+         "       fst_tool convert <fst_file> -o <fst_file> [--no-dense]\n"
+         "                        [--ratio R] [--bloom-bits B --keys <file>]\n"
+         "                        [--hex]\n"
+         "       fst_tool fprate  <fst_file> --keys <file> [<negative_file>]\n"
+         "                        [--samples N] [--target RATE] [--hex]\n";
+}
+
+SuffixType parseSuffixType(const std::string &name) {
+  if (name == "none") return kNone;
+  if (name == "hash") return kHash;
+  if (name == "real") return kReal;
+  throw std::invalid_argument("unknown suffix type: " + name);
+}
+
+const char *suffixTypeName(const SuffixType type) {
+  switch (type) {
+    case kHash:
+      return "hash";
+    case kReal:
+      return "real";
+    default:
+      return "none";
+  }
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options opts;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "-o" || arg == "--output")
+      opts.output_path = next();
+    else if (arg == "--keys")
+      opts.key_path = next();
+    else if (arg == "--hex")
+      opts.hex = true;
+    else if (arg == "--sorted")
+      opts.sorted = true;
+    else if (arg == "--threads")
+      opts.threads = std::max(1, std::stoi(next()));
+    else if (arg == "--no-dense")
+      opts.include_dense = false;
+    else if (arg == "--ratio")
+      opts.sparse_dense_ratio = std::stoul(next());
+    else if (arg == "--bloom-bits")
+      opts.bloom_bits_per_key = std::stoul(next());
+    else if (arg == "--suffix")
+      opts.suffix_type = parseSuffixType(next());
+    else if (arg == "--suffix-bits")
+      opts.suffix_len = std::stoul(next());
+    else if (arg == "--samples")
+      opts.samples = std::stoull(next());
+    else if (arg == "--target")
+      opts.target_rate = std::stod(next());
+    else if (arg.size() > 1 && arg[0] == '-')
+      throw std::invalid_argument("unknown argument: " + arg);
+    else
+      opts.positional.push_back(arg);
+  }
+  return opts;
+}
+
+void requireArgs(const Options &opts, const size_t num_positional,
+                 const bool needs_output) {
+  if (opts.positional.size() != num_positional)
+    throw std::invalid_argument("wrong number of arguments");
+  if (needs_output && opts.output_path.empty())
+    throw std::invalid_argument("missing output path (-o)");
+}
+
+double secondsSince(const Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int build(const Options &opts) {
+  requireArgs(opts, 1, true);
+  auto start = Clock::now();
+  std::vector<std::string> keys =
+      tools::readKeyFile(opts.positional[0], opts.hex);
+  fprintf(stderr, "read %zu keys in %.3f s\n", keys.size(),
+          secondsSince(start));
+
+  start = Clock::now();
+  if (opts.sorted) {
+    if (!std::is_sorted(keys.begin(), keys.end()))
+      throw std::runtime_error("key file is not sorted (drop --sorted)");
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  } else {
+    tools::parallelSortAndUnique(keys, opts.threads);
+  }
+  fprintf(stderr, "sorted %zu unique keys in %.3f s (%u threads)\n",
+          keys.size(), secondsSince(start), opts.threads);
+  if (keys.empty()) throw std::runtime_error("key file is empty");
+  if (opts.suffix_len > kWordSize)
+    throw std::invalid_argument("--suffix-bits must be at most 64");
+
+  start = Clock::now();
+  FST fst(keys, opts.include_dense, opts.sparse_dense_ratio,
+          opts.bloom_bits_per_key, opts.suffix_type, opts.suffix_len);
+  fprintf(stderr, "built fst in %.3f s\n", secondsSince(start));
+
+  tools::writeFST(fst, opts.output_path);
+  fprintf(stderr, "wrote %lu bytes to %s\n", fst.serializedSize(),
+          opts.output_path.c_str());
+  return 0;
+}
+
+int inspect(const Options &opts) {
+  requireArgs(opts, 1, false);
+  auto fst = tools::loadFST(opts.positional[0]);
+  auto stats = fst->getLevelStats();
+  uint64_t num_values = 0;
+  for (auto &level : stats) num_values += level.value_count;
+
+  printf("keys:               %lu\n", num_values);
+  printf("height:             %u\n", fst->getHeight());
+  printf("sparse start level: %u\n", fst->getSparseStartLevel());
+  printf("suffix:             %s, %u bits\n",
+         suffixTypeName(fst->getSuffixType()), fst->getSuffixLen());
+  printf("serialized size:    %lu bytes\n", fst->serializedSize());
+  printf("memory usage:       %lu bytes (%.2f bits/key)\n",
+         fst->getMemoryUsage(),
+         num_values ? 8.0 * (double)fst->getMemoryUsage() / (double)num_values
+                    : 0.0);
+
+  printf("\n%-6s %-7s %12s %12s %12s %12s %8s\n", "level", "layout", "nodes",
+         "labels", "children", "values", "fanout");
+  for (auto &level : stats)
+    printf("%-6u %-7s %12lu %12lu %12lu %12lu %8.2f\n", level.level,
+           level.is_dense ? "dense" : "sparse", level.node_count,
+           level.label_count, level.child_count, level.value_count,
+           level.node_count ? (double)level.label_count / level.node_count
+                            : 0.0);
+
+  // nodes per fanout bucket [2^i, 2^(i + 1)) from the statistics sidecar
+  const KeyStats &key_stats = fst->getKeyStats();
+  printf("\nnodes by fanout\n%-6s", "level");
+  for (uint32_t bucket = 0; bucket < KeyStats::kFanoutBuckets; bucket++)
+    printf(" %9s", (">=" + std::to_string(1u << bucket)).c_str());
+  printf("\n");
+  for (level_t level = 0; level < key_stats.getNumLevels(); level++) {
+    printf("%-6u", level);
+    for (uint32_t bucket = 0; bucket < KeyStats::kFanoutBuckets; bucket++)
+      printf(" %9lu", key_stats.getFanoutCount(level, bucket));
+    printf("\n");
+  }
+
+  printf("\n%-34s %14s %7s\n", "component", "bytes", "share");
+  auto components = fst->getMemoryBreakdown();
+  uint64_t total = 0;
+  for (auto &component : components) total += component.second;
+  for (auto &component : components)
+    printf("%-34s %14lu %6.2f%%\n", component.first.c_str(), component.second,
+           total ? 100.0 * (double)component.second / (double)total : 0.0);
+  return 0;
+}
+
+int query(const Options &opts) {
+  requireArgs(opts, 2, false);
+  auto fst = tools::loadFST(opts.positional[0]);
+  std::vector<std::string> keys;
+  if (!opts.key_path.empty()) {
+    keys = tools::readKeyFile(opts.key_path, opts.hex);
+    tools::sortAndUnique(keys);
+  }
+  std::vector<std::string> queries =
+      tools::readKeyFile(opts.positional[1], opts.hex);
+
+  // look up the whole batch first, print afterwards
+  std::vector<uint64_t> values(queries.size());
+  std::vector<uint8_t> found(queries.size());
+  auto start = Clock::now();
+  for (size_t i = 0; i < queries.size(); i++)
+    found[i] = fst->lookupKey(queries[i], values[i]);
+  double elapsed = secondsSince(start);
+
+  uint64_t num_found = 0;
+  uint64_t num_false_positives = 0;
+  for (size_t i = 0; i < queries.size(); i++) {
+    const std::string key = opts.hex ? tools::encodeHex(queries[i])
+                                     : queries[i];
+    if (!found[i]) {
+      printf("%s\t-\n", key.c_str());
+      continue;
+    }
+    if (!keys.empty() &&
+        (values[i] >= keys.size() || keys[values[i]] != queries[i])) {
+      num_false_positives++;
+      printf("%s\t-\t(false positive %lu)\n", key.c_str(), values[i]);
+      continue;
+    }
+    num_found++;
+    printf("%s\t%lu\n", key.c_str(), values[i]);
+  }
+  fprintf(stderr,
+          "%zu queries, %lu found, %lu false positives, %.3f s (%.0f ns/key)\n",
+          queries.size(), num_found, num_false_positives, elapsed,
+          queries.empty() ? 0.0 : elapsed * 1e9 / (double)queries.size());
+  return 0;
+}
+
+int convert(const Options &opts) {
+  requireArgs(opts, 1, true);
+  auto fst = tools::loadFST(opts.positional[0]);
+
+  // the stored (truncated) keys form a prefix free set that yields the same
+  // trie when rebuilt, so the original keys are not needed
+  std::vector<std::string> keys;
+  std::vector<uint64_t> values;
+  for (auto iter = fst->moveToFirst(); iter.isValid(); iter++) {
+    keys.push_back(iter.getKey());
+    values.push_back(iter.getValue());
+  }
+
+  // the pre-filter hashes full keys, it can only be rebuilt from them
+  if (opts.bloom_bits_per_key > 0 && opts.key_path.empty())
+    throw std::invalid_argument("--bloom-bits requires --keys");
+  if (fst->hasBloomFilter() && opts.bloom_bits_per_key == 0)
+    fprintf(stderr, "dropping bloom filter (pass --bloom-bits and --keys)\n");
+  // suffix bits are derived from the full keys as well
+  if (fst->getSuffixType() != kNone)
+    fprintf(stderr, "dropping %s suffix bits\n",
+            suffixTypeName(fst->getSuffixType()));
+
+  auto start = Clock::now();
+  FST converted(keys, values, opts.include_dense, opts.sparse_dense_ratio);
+  if (opts.bloom_bits_per_key > 0) {
+    std::vector<std::string> original_keys =
+        tools::readKeyFile(opts.key_path, opts.hex);
+    tools::sortAndUnique(original_keys);
+    converted.buildBloomFilter(original_keys, opts.bloom_bits_per_key);
+  }
+  fprintf(stderr,
+          "re-encoded %zu keys in %.3f s: sparse start level %u -> %u, "
+          "%lu -> %lu bytes\n",
+          keys.size(), secondsSince(start), fst->getSparseStartLevel(),
+          converted.getSparseStartLevel(), fst->serializedSize(),
+          converted.serializedSize());
+  tools::writeFST(converted, opts.output_path);
+  return 0;
+}
+
+int fprate(const Options &opts) {
+  if (opts.positional.empty() || opts.positional.size() > 2)
+    throw std::invalid_argument("wrong number of arguments");
+  if (opts.key_path.empty())
+    throw std::invalid_argument("fprate requires --keys for verification");
+  auto fst = tools::loadFST(opts.positional[0]);
+  std::vector<std::string> keys = tools::readKeyFile(opts.key_path, opts.hex);
+  tools::sortAndUnique(keys);
+
+  FST::FalsePositiveStats stats;
+  if (opts.positional.size() == 2) {
+    stats = fst->estimateFalsePositives(
+        keys, tools::readKeyFile(opts.positional[1], opts.hex),
+        opts.target_rate);
+  } else {
+    printf("synthetic near-miss sample of %lu keys\n", opts.samples);
+    stats = fst->estimateFalsePositives(keys, opts.samples, opts.target_rate);
+  }
+
+  printf("negative queries:      %lu (%lu stored keys skipped)\n",
+         stats.num_queries, stats.num_positives_skipped);
+  printf("rejected by trie:      %lu\n", stats.num_true_negatives);
+  printf("false positives:       %lu (rate %.6f)\n", stats.num_false_positives,
+         stats.false_positive_rate);
+  for (level_t level = 0; level < stats.false_positives_per_level.size();
+       level++) {
+    uint64_t count = stats.false_positives_per_level[level];
+    if (count == 0) continue;
+    printf("  leaf level %-4u      %lu (rate %.6f)\n", level, count,
+           (double)count / (double)stats.num_queries);
+  }
+  printf("target rate %.6f needs %u fingerprint bits or %u real suffix bits "
+         "(rate %.6f)\n",
+         opts.target_rate, stats.fingerprint_bits, stats.real_suffix_bits,
+         stats.real_suffix_rate);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  static const std::map<std::string, int (*)(const Options &)> kCommands = {
+      {"build", build},
+      {"inspect", inspect},
+      {"query", query},
+      {"convert", convert},
+      {"fprate", fprate}};
+
+  auto command = kCommands.find(argv[1]);
+  if (command == kCommands.end()) {
+    usage();
+    return 1;
+  }
+  try {
+    return command->second(parseOptions(argc, argv));
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << "\n";
+    usage();
+  } catch (const std::exception &e) {
+    std::cerr << "error: " << e.what() << "\n";
+  }
+  return 1;
+}
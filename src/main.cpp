@@ -1,3 +1,1031 @@
 #include <mmphf_fst.hpp>
 
-int main() { return 0; }
+#include "tool_common.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <tuple>
+
+using namespace mmphf_fst;
+
+namespace {
+
+// Reports a failed check; main runs every check and fails if one did.
+bool check(const bool condition, const char *what) {
+  if (!condition) fprintf(stderr, "check failed: %s\n", what);
+  return condition;
+}
+
+// n distinct sorted keys of 1 to 12 random lowercase bytes, none a prefix of
+// another, so lookups and seeks over them are exact
+std::vector<std::string> sortedKeys(const uint64_t n, const uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::string> keys;
+  while (keys.size() < n) {
+    std::string key(1 + rng() % 12, 'a');
+    for (char &c : key) c = 'a' + rng() % 26;
+    keys.push_back(key + '\x01');
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+// A deserialized FST with its keys re-attached answers like the original;
+// a short or foreign image is not taken for an FST.
+bool checkSerialize() {
+  std::vector<std::string> keys = sortedKeys(2000, 76);
+  FST fst(keys);
+  std::unique_ptr<char[]> data(fst.serialize());
+  uint64_t size = fst.serializedSize();
+  bool ok = check(FST::isImage(data.get(), size), "serialized image");
+  ok &= check(!FST::isImage(data.get(), size - 1), "truncated image");
+  ok &= check(!FST::isImage(data.get(), 8), "short image");
+  std::string foreign(size, 'x');
+  ok &= check(!FST::isImage(foreign.data(), size), "foreign image");
+
+  std::unique_ptr<FST> copy(FST::deSerialize(data.get()));
+  copy->setKeys(keys);
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    if (!copy->lookupKey(keys[i], value) || value != i)
+      return check(false, "lookup after deSerialize");
+  }
+  FST::Iter iter = copy->moveToKeyGreaterThan(keys[keys.size() / 2], false);
+  ok &= check(iter.isValid() && iter.getValue() == keys.size() / 2 + 1,
+              "seek after deSerialize");
+  return ok;
+}
+
+// Explicit values, with and without dense levels; every key ends in exactly
+// one value of the level statistics.
+bool checkValuesAndLevelStats() {
+  std::vector<std::string> keys = sortedKeys(2000, 77);
+  std::vector<uint64_t> values(keys.size());
+  for (uint64_t i = 0; i < values.size(); i++) values[i] = 3 * i + 1;
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, values, include_dense, kSparseDenseRatio);
+    for (uint64_t i = 0; i < keys.size(); i++) {
+      uint64_t value = 0;
+      if (!fst.lookupKey(keys[i], value) || value != values[i]) {
+        ok &= check(false, "lookup of an explicit value");
+        break;
+      }
+    }
+    uint64_t num_values = 0;
+    for (const LevelStats &stats : fst.getLevelStats())
+      num_values += stats.value_count;
+    ok &= check(num_values == keys.size(), "level stats value count");
+    ok &= check(include_dense || fst.getSparseStartLevel() == 0,
+                "sparse-only layout");
+  }
+  return ok;
+}
+
+// Queries that run past a stored key are told apart by the zero padding of
+// real suffixes, unless their extra bytes are zero too.
+bool checkFalsePositiveEstimate() {
+  std::vector<std::string> keys = {"a", "b"};
+  FST fst(keys);
+  // 'X' and 'Y' differ from the padding in their second bit
+  FST::FalsePositiveStats stats =
+      fst.estimateFalsePositives(keys, {"aX", "bY", "c"}, 0.0);
+  bool ok = check(stats.num_queries == 3 && stats.num_false_positives == 2,
+                  "false positive count");
+  ok &= check(stats.real_suffix_bits == 2 && stats.real_suffix_rate == 0,
+              "real suffix bits past the end of a key");
+  stats = fst.estimateFalsePositives(keys, {std::string("a\0", 2)}, 0.0);
+  ok &= check(stats.real_suffix_rate == 1, "zero byte past the end of a key");
+  return ok;
+}
+
+// The Bloom pre-filter never rejects a stored key, rejects most near misses
+// the truncated trie accepts, and survives serialization.
+bool checkBloomFilter() {
+  std::vector<std::string> keys = sortedKeys(2000, 79);
+  FST plain(keys), filtered(keys, kIncludeDense, kSparseDenseRatio, 10);
+  std::unique_ptr<char[]> data(filtered.serialize());
+  std::unique_ptr<FST> copy(FST::deSerialize(data.get()));
+  bool ok = check(copy->hasBloomFilter(), "filter after deSerialize");
+  uint64_t plain_accepted = 0, filtered_accepted = 0;
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    if (!copy->lookupKey(keys[i], value) || value != i) {
+      ok &= check(false, "lookup with the pre-filter");
+      break;
+    }
+    // most keys are stored as a shorter distinguishing prefix
+    std::string near_miss = keys[i];
+    near_miss.back() = '\x02';
+    plain_accepted += plain.lookupKey(near_miss, value);
+    filtered_accepted += filtered.lookupKey(near_miss, value);
+  }
+  ok &= check(plain_accepted > keys.size() / 2, "near misses pass the trie");
+  ok &= check(filtered_accepted < plain_accepted / 10, "pre-filter rejects");
+  return ok;
+}
+
+// Range filtering never rejects a stored key; hashed suffixes reject near
+// miss points (at no more than 32 bits), real suffixes empty ranges.
+bool checkRangeFilter() {
+  std::vector<std::string> keys = sortedKeys(2000, 80);
+  FST hashed(keys, kIncludeDense, kSparseDenseRatio, 0, kHash, 48);
+  FST real(keys, kIncludeDense, kSparseDenseRatio, 0, kReal, 64);
+  bool ok = check(hashed.getSuffixLen() == kMaxHashSuffixLen,
+                  "hashed suffix clamped to the hash width");
+  uint64_t hashed_accepted = 0, real_accepted = 0;
+  for (const std::string &key : keys) {
+    std::string below = key, above = key;
+    below.back() = '\x00';
+    above.back() = '\x02';
+    if (!hashed.mayContainRange(key, key) || !real.mayContainRange(key, key) ||
+        !real.mayContainRange(below, above)) {
+      ok &= check(false, "stored key rejected");
+      break;
+    }
+    hashed_accepted += hashed.mayContainRange(above, above);
+    // nothing lies between key without its terminator and key; 64 suffix
+    // bits reach the terminator of keys of up to 9 bytes
+    if (key.length() <= 9)
+      real_accepted += real.mayContainRange(below, below + '\xff');
+  }
+  ok &= check(hashed_accepted < keys.size() / 100, "hashed suffix rejects");
+  ok &= check(real_accepted == 0, "real suffix rejects");
+  return ok;
+}
+
+// keyAtPosition returns the stored prefix of the key that maps to a value,
+// for positional and explicit values, with and without dense levels.
+bool checkKeyAtPosition() {
+  std::vector<std::string> keys = sortedKeys(2000, 81);
+  std::vector<uint64_t> values(keys.size());
+  for (uint64_t i = 0; i < values.size(); i++) values[i] = 5 * i + 2;
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST positions(keys, include_dense, kSparseDenseRatio);
+    FST explicit_values(keys, values, include_dense, kSparseDenseRatio);
+    positions.buildReverseIndex();
+    explicit_values.buildReverseIndex();
+    std::string key;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+      if (!positions.keyAtPosition(i, key) ||
+          keys[i].compare(0, key.length(), key) != 0 ||
+          !explicit_values.keyAtPosition(values[i], key) ||
+          keys[i].compare(0, key.length(), key) != 0) {
+        ok &= check(false, "key of a value");
+        break;
+      }
+    }
+    ok &= check(!positions.keyAtPosition(keys.size(), key) &&
+                    !explicit_values.keyAtPosition(values[1] - 1, key),
+                "key of an absent value");
+  }
+  return ok;
+}
+
+// encodeBatch and decodeBatch answer like lookupKey and keyAtPosition, for
+// unsorted batches with absent keys and values.
+bool checkBatchCoding() {
+  std::vector<std::string> keys = sortedKeys(2000, 82);
+  FST fst(keys);
+  fst.buildReverseIndex();
+  std::mt19937_64 rng(82);
+  std::vector<std::string> queries;
+  std::vector<uint64_t> positions;
+  for (uint64_t i = 0; i < 1000; i++) {
+    queries.push_back(keys[rng() % keys.size()]);
+    if (i % 3 == 0) queries.back().back() = '\x02';
+    positions.push_back(rng() % (keys.size() + 10));
+  }
+  std::vector<std::string_view> views(queries.begin(), queries.end());
+  std::vector<uint64_t> values;
+  std::vector<uint8_t> found;
+  fst.encodeBatch(views, values, found);
+  FST::KeyBatch batch = fst.decodeBatch(positions);
+  bool ok = check(values.size() == queries.size() &&
+                      found.size() == queries.size() &&
+                      batch.size() == positions.size(),
+                  "batch sizes");
+  for (uint64_t i = 0; ok && i < queries.size(); i++) {
+    uint64_t value = 0;
+    std::string key;
+    bool is_found = fst.lookupKey(queries[i], value);
+    bool has_key = fst.keyAtPosition(positions[i], key);
+    if (found[i] != is_found || (is_found && values[i] != value) ||
+        batch.found[i] != has_key || (has_key && batch[i] != key))
+      ok &= check(false, "batch matches single lookups");
+  }
+  return ok;
+}
+
+// topK returns the k best scored keys below a prefix, as ranking every key
+// with that prefix would.
+bool checkTopK() {
+  std::vector<std::string> keys = sortedKeys(2000, 83);
+  std::vector<uint64_t> scores(keys.size());
+  std::iota(scores.begin(), scores.end(), 0);
+  std::shuffle(scores.begin(), scores.end(), std::mt19937_64(83));
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.buildScores(scores);
+    // scores below 2048 take 11 bits each
+    uint64_t score_bytes = 0;
+    for (const auto &component : fst.getMemoryBreakdown())
+      if (component.first == "scores") score_bytes = component.second;
+    ok &= check(score_bytes > 0 && score_bytes < keys.size() * 4,
+                "bit-packed scores");
+    std::unique_ptr<char[]> data(fst.serialize());
+    std::unique_ptr<FST> copy(FST::deSerialize(data.get()));
+    ok &= check(copy->hasScores(), "scores after deSerialize");
+    // one byte prefixes end in a node, or in the leaf of their only key
+    for (std::string prefix : {"", "a", "m", "q", "z", "{"}) {
+      std::vector<std::pair<uint64_t, uint64_t>> expected;  // (score, value)
+      for (uint64_t i = 0; i < keys.size(); i++)
+        if (keys[i].compare(0, prefix.length(), prefix) == 0)
+          expected.emplace_back(scores[i], i);
+      std::sort(expected.rbegin(), expected.rend());
+      expected.resize(std::min<size_t>(expected.size(), 10));
+      for (const FST *annotated : {&fst, copy.get()}) {
+        std::vector<FST::Completion> completions = annotated->topK(prefix, 10);
+        bool is_equal = completions.size() == expected.size();
+        for (uint64_t i = 0; is_equal && i < expected.size(); i++)
+          is_equal = completions[i].score == expected[i].first &&
+                     completions[i].value == expected[i].second;
+        ok &= check(is_equal, "top k below a prefix");
+      }
+    }
+  }
+  return ok;
+}
+
+uint32_t editDistance(const std::string &a, const std::string &b) {
+  std::vector<uint32_t> row(b.size() + 1);
+  std::iota(row.begin(), row.end(), 0);
+  for (size_t i = 1; i <= a.size(); i++) {
+    uint32_t diagonal = row[0]++;
+    for (size_t j = 1; j <= b.size(); j++) {
+      uint32_t above = row[j];
+      row[j] = std::min({row[j] + 1, row[j - 1] + 1,
+                         diagonal + (a[i - 1] == b[j - 1] ? 0 : 1)});
+      diagonal = above;
+    }
+  }
+  return row.back();
+}
+
+// A Levenshtein intersection, verified against the keys, finds exactly the
+// keys within the distance.
+bool checkFuzzySearch() {
+  std::vector<std::string> keys = sortedKeys(2000, 84);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    for (uint64_t k = 0; k < keys.size(); k += 97) {
+      std::string pattern = keys[k];
+      pattern[0] = 'a' + (pattern[0] - 'a' + 1) % 26;
+      std::vector<uint64_t> expected, found;
+      for (uint64_t i = 0; i < keys.size(); i++)
+        if (editDistance(keys[i], pattern) <= 2) expected.push_back(i);
+      fst.intersect(LevenshteinAutomaton(pattern, 2),
+                    [&](const std::string &, uint64_t value, bool) {
+                      if (editDistance(keys[value], pattern) <= 2)
+                        found.push_back(value);
+                    });
+      // keys[k] itself is one substitution away
+      ok &= check(!found.empty() && found == expected, "fuzzy matches");
+    }
+  }
+  return ok;
+}
+
+// Keys that are prefixes of other keys are looked up, iterated and matched
+// exactly, with and without dense levels.
+bool checkPrefixKeys() {
+  std::mt19937_64 rng(85);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 2000; i++) {
+    std::string key(1 + rng() % 6, 'a');
+    for (char &c : key) c = 'a' + rng() % 4;
+    keys.push_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    FST::Iter iter = fst.moveToKeyGreaterThan(keys[0], true);
+    for (uint64_t i = 0; i < keys.size(); i++, iter++) {
+      uint64_t value = 0;
+      level_t match_len = 0;
+      if (!fst.lookupKey(keys[i], value) || value != i || !iter.isValid() ||
+          iter.getValue() != i ||
+          !fst.longestPrefixMatch(keys[i] + "z", value, match_len) ||
+          value != i || match_len != keys[i].length()) {
+        ok &= check(false, "prefix key");
+        break;
+      }
+    }
+    ok &= check(!iter.isValid(), "iteration ends after the last key");
+  }
+
+  // a sparse root of more than two words of labels
+  keys.clear();
+  for (int c = 1; c <= 130; c++) keys.push_back(std::string(1, (char)c));
+  FST wide(keys, false, kSparseDenseRatio);
+  // its size ends at the last label, not at the end of the last word
+  for (int c = 0; c < 256; c++) {
+    std::string key(1, (char)c);
+    uint64_t value = 0;
+    bool found = wide.lookupKey(key, value);
+    FST::Iter at = wide.moveToKeyGreaterThan(key, true);
+    FST::Iter after = wide.moveToKeyGreaterThan(key, false);
+    // key c is value c - 1, the first key greater than it value c
+    uint64_t at_value = c == 0 ? 0 : c - 1;
+    if (found != (c >= 1 && c <= 130) || (found && value != at_value) ||
+        at.isValid() != (c <= 130) ||
+        (at.isValid() && at.getValue() != at_value) ||
+        after.isValid() != (c < 130) ||
+        (after.isValid() && after.getValue() != (uint64_t)c)) {
+      ok &= check(false, "search in a wide last node");
+      break;
+    }
+  }
+  return ok;
+}
+
+// intersectKeys and differenceKeys report the positions of the shared and
+// the missing keys in key order, for any mix of layouts.
+bool checkKeySetOperations() {
+  std::vector<std::string> keys_a = sortedKeys(1500, 86);
+  std::vector<std::string> keys_b = sortedKeys(1000, 860);
+  for (uint64_t i = 0; i < keys_a.size(); i += 2) keys_b.push_back(keys_a[i]);
+  std::sort(keys_b.begin(), keys_b.end());
+  keys_b.erase(std::unique(keys_b.begin(), keys_b.end()), keys_b.end());
+
+  std::vector<std::pair<uint64_t, uint64_t>> expected_shared;
+  std::vector<uint64_t> expected_missing;
+  for (uint64_t i = 0; i < keys_a.size(); i++) {
+    auto it = std::lower_bound(keys_b.begin(), keys_b.end(), keys_a[i]);
+    if (it != keys_b.end() && *it == keys_a[i])
+      expected_shared.emplace_back(i, it - keys_b.begin());
+    else
+      expected_missing.push_back(i);
+  }
+
+  bool ok = true;
+  for (bool dense_a : {false, true}) {
+    for (bool dense_b : {false, true}) {
+      FST a(keys_a, dense_a, kSparseDenseRatio);
+      FST b(keys_b, dense_b, kSparseDenseRatio);
+      a.setKeys(keys_a);
+      b.setKeys(keys_b);
+      std::vector<std::pair<uint64_t, uint64_t>> shared;
+      std::vector<uint64_t> missing;
+      FST::intersectKeys(a, b, [&](uint64_t value_a, uint64_t value_b) {
+        shared.emplace_back(value_a, value_b);
+      });
+      FST::differenceKeys(
+          a, b, [&](uint64_t value_a) { missing.push_back(value_a); });
+      ok &= check(shared == expected_shared, "intersectKeys");
+      ok &= check(missing == expected_missing, "differenceKeys");
+    }
+  }
+  return ok;
+}
+
+// MergingIter visits the keys of all sources in key order, equal keys in
+// source order, from the first key and from a seek.
+bool checkMergingIter() {
+  std::vector<std::vector<std::string>> keys = {
+      sortedKeys(700, 87), sortedKeys(500, 870), sortedKeys(300, 87)};
+  std::vector<std::unique_ptr<FST>> fsts;
+  std::vector<const FST *> sources;
+  // (key, source, position), sorted
+  std::vector<std::tuple<std::string, size_t, uint64_t>> expected;
+  for (size_t source = 0; source < keys.size(); source++) {
+    fsts.emplace_back(new FST(keys[source], source != 1, kSparseDenseRatio));
+    fsts.back()->setKeys(keys[source]);
+    sources.push_back(fsts.back().get());
+    for (uint64_t i = 0; i < keys[source].size(); i++)
+      expected.emplace_back(keys[source][i], source, i);
+  }
+  std::sort(expected.begin(), expected.end());
+
+  bool ok = true;
+  MergingIter iter(sources);
+  const std::string &middle = std::get<0>(expected[expected.size() / 2]);
+  for (bool seek : {false, true}) {
+    size_t i = 0;
+    if (seek) {
+      iter.seek(middle);
+      while (std::get<0>(expected[i]) < middle) i++;
+    } else {
+      iter.seekToFirst();
+    }
+    for (; i < expected.size() && iter.isValid(); i++, iter++) {
+      if (iter.getSource() != std::get<1>(expected[i]) ||
+          iter.getValue() != std::get<2>(expected[i]))
+        break;
+    }
+    ok &= check(i == expected.size() && !iter.isValid(), "merged order");
+  }
+  return ok;
+}
+
+// skipTo with ascending targets lands where a fresh seek would, also at and
+// around keys that are prefixes of other keys.
+bool checkSkipTo() {
+  std::mt19937_64 rng(88);
+  auto randomKey = [&]() {
+    std::string key(1 + rng() % 6, 'a');
+    for (char &c : key) c = 'a' + rng() % 4;
+    return key;
+  };
+  std::vector<std::string> keys, targets;
+  for (int i = 0; i < 2000; i++) keys.push_back(randomKey());
+  for (int i = 0; i < 500; i++) targets.push_back(randomKey());
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::sort(targets.begin(), targets.end());
+
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    FST::Iter iter = fst.moveToKeyGreaterThan(keys[0], true);
+    for (const std::string &target : targets) {
+      uint64_t expected =
+          std::lower_bound(keys.begin(), keys.end(), target) - keys.begin();
+      bool valid = iter.skipTo(target);
+      if (valid != (expected < keys.size()) ||
+          (valid && iter.getValue() != expected)) {
+        ok &= check(false, "skipTo");
+        break;
+      }
+    }
+  }
+  return ok;
+}
+
+// seekBatch lands every iterator where a single seek does, for stored keys,
+// near misses and keys past the end, in more than one window.
+bool checkSeekBatch() {
+  std::vector<std::string> keys = sortedKeys(3000, 89);
+  std::vector<std::string> queries;
+  std::mt19937_64 rng(89);
+  for (int i = 0; i < 100; i++) {
+    std::string query = keys[rng() % keys.size()];
+    if (i % 3 == 1) query.back() = '\x02';
+    if (i % 3 == 2) query = "zzzzzzzzzzzzz";
+    queries.push_back(query);
+  }
+  std::vector<std::string_view> views(queries.begin(), queries.end());
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    for (bool inclusive : {false, true}) {
+      std::vector<FST::Iter> iters = fst.seekBatch(views, inclusive);
+      for (size_t i = 0; i < queries.size(); i++) {
+        FST::Iter iter = fst.moveToKeyGreaterThan(queries[i], inclusive);
+        if (iters[i].isValid() != iter.isValid() ||
+            (iter.isValid() && iters[i].getValue() != iter.getValue())) {
+          ok &= check(false, "seekBatch");
+          break;
+        }
+      }
+    }
+  }
+  return ok;
+}
+
+// position of the greatest key < key (<= if inclusive), -1 for none
+int64_t expectedLessThan(const std::vector<std::string> &keys,
+                         const std::string &key, const bool inclusive) {
+  auto it = inclusive ? std::upper_bound(keys.begin(), keys.end(), key)
+                      : std::lower_bound(keys.begin(), keys.end(), key);
+  return it - keys.begin() - 1;
+}
+
+// position of the smallest key > key (>= if inclusive), -1 for none
+int64_t expectedGreaterThan(const std::vector<std::string> &keys,
+                            const std::string &key, const bool inclusive) {
+  auto it = inclusive ? std::lower_bound(keys.begin(), keys.end(), key)
+                      : std::upper_bound(keys.begin(), keys.end(), key);
+  return it == keys.end() ? -1 : it - keys.begin();
+}
+
+int64_t position(const FST::Iter &iter) {
+  return iter.isValid() ? (int64_t)iter.getValue() : -1;
+}
+
+// Seeks both ways land on the neighbours of every query; keys are exact or
+// attached, so the answers are too.
+bool checkSeeks(const FST &fst, const std::vector<std::string> &keys,
+                const std::vector<std::string> &queries) {
+  for (const std::string &query : queries) {
+    for (bool inclusive : {false, true}) {
+      int64_t less = position(fst.moveToKeyLessThan(query, inclusive));
+      int64_t greater = position(fst.moveToKeyGreaterThan(query, inclusive));
+      if (less != expectedLessThan(keys, query, inclusive) ||
+          greater != expectedGreaterThan(keys, query, inclusive))
+        return check(false, "seek neighbours");
+    }
+    if (position(fst.moveToKeyLessThan(query)) !=
+        expectedLessThan(keys, query, false))
+      return check(false, "seek below by default");
+  }
+  return true;
+}
+
+// moveToKeyLessThan finds the predecessor, with and without dense levels,
+// and around a sparse last node wider than a word, whose size ends at its
+// last bit.
+bool checkSeekForPrev() {
+  std::vector<std::string> keys = sortedKeys(2000, 90), queries;
+  for (uint64_t i = 0; i < keys.size(); i += 7) {
+    queries.push_back(keys[i]);
+    queries.push_back(keys[i].substr(0, keys[i].length() - 1) + '\x02');
+    queries.push_back(keys[i].substr(0, (keys[i].length() + 1) / 2));
+  }
+  queries.push_back("a");
+  queries.push_back("zzzzzzzzzzzzz");
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    ok &= checkSeeks(fst, keys, queries);
+  }
+
+  // the root is the last node: 127 even labels, odd bytes fall between
+  keys.clear();
+  queries = {std::string("\x00\xaa", 2), "\xff\xff"};
+  for (int c = 0x02; c <= 0xfe; c += 2) keys.push_back(std::string(1, c));
+  for (int c = 0x01; c <= 0xff; c++) queries.push_back(std::string(1, c));
+  FST root(keys, false, 1);
+  ok &= checkSeeks(root, keys, queries);
+
+  // the last node is a child: "c" followed by 127 even labels
+  keys = {"a", "b"};
+  queries = {std::string("\x00\xaa", 2), "a", "b", "c", "d"};
+  for (int c = 0x02; c <= 0xfe; c += 2) keys.push_back("c" + std::string(1, c));
+  for (int c = 0x01; c <= 0xff; c++) queries.push_back("c" + std::string(1, c));
+  FST child(keys, false, 1);
+  ok &= checkSeeks(child, keys, queries);
+  return ok;
+}
+
+// A scan paginated through tokens, resumed on a deserialized copy, visits
+// every key once; tokens of another build or cut short are rejected.
+bool checkResumeTokens() {
+  std::vector<std::string> keys = sortedKeys(2000, 91);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    std::unique_ptr<char[]> data(fst.serialize());
+    std::unique_ptr<FST> copy(FST::deSerialize(data.get()));
+    std::vector<uint64_t> visited;
+    FST::Iter iter = fst.moveToFirst();
+    std::string token;
+    while (iter.isValid()) {
+      for (int i = 0; i < 37 && iter.isValid(); i++, iter++)
+        visited.push_back(iter.getValue());
+      token = iter.saveToken();
+      if (!copy->resume(token, iter)) break;
+    }
+    std::vector<uint64_t> expected(keys.size());
+    std::iota(expected.begin(), expected.end(), 0);
+    ok &= check(visited == expected, "paginated scan");
+
+    FST other(sortedKeys(2000, 910), include_dense, kSparseDenseRatio);
+    token = fst.moveToKeyGreaterThan(keys[1000], true).saveToken();
+    ok &= check(!other.resume(token, iter), "token of another build");
+    ok &= check(!fst.resume(token.substr(0, token.size() - 1), iter),
+                "truncated token");
+  }
+  return ok;
+}
+
+// Ranks are key positions independent of the values: getRank and
+// keysAtRanks invert each other, samples stay within their bounds.
+bool checkRanks() {
+  std::vector<std::string> keys = sortedKeys(2000, 92);
+  std::vector<uint64_t> values(keys.size()), ranks(keys.size());
+  for (uint64_t i = 0; i < values.size(); i++) values[i] = 3 * i + 1;
+  std::iota(ranks.begin(), ranks.end(), 0);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    // seeks compare against the keys by value, so explicit values are
+    // walked to from the first key
+    FST fst(keys, values, include_dense, kSparseDenseRatio);
+    fst.buildKeyCounts();
+    std::vector<FST::RankedKey> ranked = fst.keysAtRanks(ranks);
+    FST::Iter iter = fst.moveToFirst();
+    for (uint64_t rank = 0; rank < keys.size(); rank++, iter++) {
+      if (ranked[rank].rank != rank || ranked[rank].value != values[rank] ||
+          keys[rank].compare(0, ranked[rank].key.length(),
+                             ranked[rank].key) != 0 ||
+          fst.getRank(iter) != rank) {
+        ok &= check(false, "rank of a key");
+        break;
+      }
+    }
+    ok &= check(fst.getRank(iter) == fst.getNumKeys(),
+                "rank past the last key");
+
+    FST positions(keys, include_dense, kSparseDenseRatio);
+    positions.buildKeyCounts();
+    std::mt19937_64 rng(92);
+    std::vector<FST::RankedKey> samples =
+        positions.sample(keys[100], keys[300], 50, rng);
+    bool in_bounds = samples.size() == 50;
+    for (size_t i = 0; i < samples.size(); i++)
+      in_bounds &= samples[i].rank >= 100 && samples[i].rank <= 300 &&
+                   samples[i].value == samples[i].rank &&
+                   (i == 0 || samples[i - 1].rank <= samples[i].rank);
+    ok &= check(in_bounds, "samples of a key range");
+  }
+  return ok;
+}
+
+// (prefix, lo, hi) groups of the keys of ranks [begin, end) by their first
+// len bytes
+std::vector<std::tuple<std::string, uint64_t, uint64_t>> prefixGroups(
+    const std::vector<std::string> &keys, const size_t len, uint64_t begin,
+    const uint64_t end) {
+  std::vector<std::tuple<std::string, uint64_t, uint64_t>> groups;
+  for (uint64_t i = begin; i < end; i++) {
+    if (i + 1 == end || keys[i + 1].compare(0, len, keys[i], 0, len) != 0) {
+      groups.emplace_back(keys[i].substr(0, len), begin, i + 1);
+      begin = i + 1;
+    }
+  }
+  return groups;
+}
+
+// forEachPrefix reports the groups of equal prefixes with their rank
+// intervals, over all keys and over a range.
+bool checkForEachPrefix() {
+  std::vector<std::string> keys = sortedKeys(2000, 93);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    fst.buildKeyCounts();
+    for (level_t len : {1, 2, 3}) {
+      std::vector<std::tuple<std::string, uint64_t, uint64_t>> groups;
+      auto collect = [&](const std::string &prefix, uint64_t lo, uint64_t hi) {
+        groups.emplace_back(prefix, lo, hi);
+      };
+      fst.forEachPrefix(len, collect);
+      ok &= check(groups == prefixGroups(keys, len, 0, keys.size()),
+                  "prefix groups");
+      groups.clear();
+      fst.forEachPrefix(len, keys[100], keys[300], collect);
+      ok &= check(groups == prefixGroups(keys, len, 100, 301),
+                  "prefix groups of a range");
+    }
+  }
+  return ok;
+}
+
+// Exact counts match the keys, estimates are within two histogram buckets
+// and survive serialization.
+bool checkCardinality() {
+  std::vector<std::string> keys = sortedKeys(2000, 94);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    std::unique_ptr<char[]> data(fst.serialize());
+    std::unique_ptr<FST> copy(FST::deSerialize(data.get()));
+    double bucket = (double)keys.size() / KeyStats::kMaxBuckets;
+    for (uint64_t left = 0; left < keys.size(); left += 211) {
+      uint64_t right = std::min<uint64_t>(left + 700, keys.size() - 1);
+      double estimate = fst.estimateRangeCount(keys[left], keys[right]);
+      if (fst.countRange(keys[left], keys[right]) != right - left + 1 ||
+          std::abs(estimate - (right - left + 1)) > 2 * bucket ||
+          copy->estimateRangeCount(keys[left], keys[right]) != estimate) {
+        ok &= check(false, "range count");
+        break;
+      }
+    }
+    for (std::string prefix : {"a", "k", "mq", "z", "{"}) {
+      uint64_t count = 0;
+      for (const std::string &key : keys) count += key.rfind(prefix, 0) == 0;
+      ok &= check(fst.countPrefix(prefix) == count &&
+                      std::abs(fst.estimatePrefixCount(prefix) - count) <=
+                          2 * bucket,
+                  "prefix count");
+    }
+  }
+  return ok;
+}
+
+// suffixRange reports the keys ending with a suffix in reversed key order;
+// a duplicate key keeps its first value.
+bool checkSuffixIndex() {
+  std::vector<std::string> keys = sortedKeys(2000, 95);
+  SuffixIndex index(keys);
+  index.setKeys(keys);
+  bool ok = true;
+  for (std::string suffix : {"\x01", "a\x01", "qa\x01", "zzz\x01", "\x02"}) {
+    std::vector<std::pair<std::string, uint64_t>> matches;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+      if (keys[i].length() >= suffix.length() &&
+          keys[i].compare(keys[i].length() - suffix.length(), suffix.length(),
+                          suffix) == 0)
+        matches.emplace_back(std::string(keys[i].rbegin(), keys[i].rend()), i);
+    }
+    std::sort(matches.begin(), matches.end());
+    std::vector<uint64_t> expected;
+    for (const auto &match : matches) expected.push_back(match.second);
+    ok &= check(index.suffixRange(suffix) == expected, "suffix range");
+  }
+
+  std::vector<std::string> duplicates = {"ab", "ab", "cb"};
+  std::vector<uint64_t> values = {7, 3, 5};
+  SuffixIndex first_value(duplicates, &values);
+  ok &= check(first_value.suffixRange("ab") == std::vector<uint64_t>{7} &&
+                  first_value.suffixRange("b") == std::vector<uint64_t>{7, 5},
+              "duplicate key keeps its first value");
+  return ok;
+}
+
+// Typing a key byte by byte keeps the cursor's range on the keys starting
+// with the prefix; a byte no key continues with is refused.
+bool checkPrefixCursor() {
+  std::vector<std::string> keys = sortedKeys(2000, 96);
+  bool ok = true;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, include_dense, kSparseDenseRatio);
+    fst.setKeys(keys);
+    fst.buildKeyCounts();
+    FST::PrefixCursor cursor(&fst);
+    for (uint64_t i = 0; i < keys.size(); i += 37) {
+      for (char byte : keys[i]) {
+        std::vector<label_t> children = cursor.children();
+        bool is_child = std::find(children.begin(), children.end(),
+                                  (label_t)byte) != children.end();
+        if (!is_child || !cursor.extend(byte) || cursor.extend('{')) {
+          ok &= check(false, "extend by a key byte");
+          break;
+        }
+        const std::string &prefix = cursor.getPrefix();
+        auto begin = std::lower_bound(keys.begin(), keys.end(), prefix);
+        auto end = std::partition_point(
+            begin, keys.end(),
+            [&](const std::string &key) { return key.rfind(prefix, 0) == 0; });
+        std::pair<uint64_t, uint64_t> range(begin - keys.begin(),
+                                            end - keys.begin());
+        if (cursor.range() != range) {
+          ok &= check(false, "range of a prefix");
+          break;
+        }
+      }
+      ok &= check(cursor.range() == std::make_pair(i, i + 1), "range of a key");
+      while (cursor.retract()) {
+      }
+      std::pair<uint64_t, uint64_t> all(0, keys.size());
+      ok &= check(cursor.getPrefix().empty() && cursor.range() == all,
+                  "range of the empty prefix");
+    }
+  }
+  return ok;
+}
+
+// Values are packed at the width of the largest one, across word borders
+// and through serialization, from all zero up to 64 bits.
+bool checkValueVector() {
+  bool ok = true;
+  std::mt19937_64 rng(97);
+  for (level_t width : {0, 1, 7, 41, 64}) {
+    std::vector<uint64_t> values(1000);
+    for (uint64_t &value : values)
+      value = width == 0 ? 0 : rng() >> (kWordSize - width);
+    values[500] = width == 0 ? 0 : ~0ull >> (kWordSize - width);
+    ValueVector packed(values);
+    std::unique_ptr<char[]> data(new char[packed.serializedSize()]);
+    char *dst = data.get();
+    BufferWriter out(dst);
+    packed.serialize(out);
+    char *src = data.get();
+    std::unique_ptr<ValueVector> copy = ValueVector::deSerialize(src);
+    bool equal = packed.getWidth() == width &&
+                 dst - data.get() == (int64_t)packed.serializedSize() &&
+                 src == dst;
+    for (position_t i = 0; i < values.size(); i++)
+      equal &= packed[i] == values[i] && (*copy)[i] == values[i];
+    ok &= check(equal, "packed values");
+  }
+
+  // full 64 bit payloads through the FST
+  std::vector<std::string> keys = sortedKeys(2000, 97);
+  std::vector<uint64_t> values(keys.size());
+  for (uint64_t i = 0; i < values.size(); i++) values[i] = ~0ull - 3 * i;
+  for (bool include_dense : {false, true}) {
+    FST fst(keys, values, include_dense, kSparseDenseRatio);
+    for (uint64_t i = 0; i < keys.size(); i++) {
+      uint64_t value = 0;
+      if (!fst.lookupKey(keys[i], value) || value != values[i]) {
+        ok &= check(false, "lookup of a 64 bit value");
+        break;
+      }
+    }
+  }
+  return ok;
+}
+
+// Every key maps to its block, before and after serialization; a range maps to
+// the blocks of its bounds.
+bool checkBlockIndex() {
+  std::vector<std::string> keys = sortedKeys(5000, 98);
+  std::vector<uint64_t> blocks(keys.size());
+  for (uint64_t i = 0; i < blocks.size(); i++) blocks[i] = i / 100;
+  BlockIndex index(keys, blocks);
+  std::unique_ptr<char[]> data(index.serialize());
+  std::unique_ptr<BlockIndex> copy(BlockIndex::deSerialize(data.get()));
+  bool ok = check(copy->getNumBlocks() == blocks.back() + 1, "block count");
+  uint64_t block = 0, first_block = 0, last_block = 0;
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    if (!index.lookupBlock(keys[i], block) || block != blocks[i] ||
+        !copy->lookupBlock(keys[i], block) || block != blocks[i]) {
+      ok &= check(false, "block of a key");
+      break;
+    }
+  }
+  for (uint64_t i = 0; i + 700 < keys.size(); i += 350) {
+    if (!copy->lookupBlockRange(keys[i], keys[i + 700], first_block,
+                                last_block) ||
+        first_block != blocks[i] || last_block != blocks[i + 700]) {
+      ok &= check(false, "blocks of a range");
+      break;
+    }
+  }
+  ok &= check(!copy->lookupBlock(std::string(1, '\x01'), block),
+              "key before the first block");
+  return ok;
+}
+
+// A sparse-only block index with one block per key, so the root holds 127
+// one byte separators. Keys before the first separator have no block.
+bool checkWideBlockIndex() {
+  std::vector<std::string> keys;
+  std::vector<uint64_t> blocks;
+  for (int c = 0x02; c <= 0xfe; c += 2) {
+    keys.push_back(std::string(1, c));
+    blocks.push_back(blocks.size());
+  }
+  BlockIndex index(keys, blocks, false, 1);
+  bool ok = true;
+  std::vector<std::string> queries = {std::string("\x00\xaa", 2), "\xff\xff"};
+  for (int c = 0x01; c <= 0xff; c++) queries.push_back(std::string(1, c));
+  for (const std::string &query : queries) {
+    int64_t expected = expectedLessThan(keys, query, true);
+    uint64_t block = 0, first_block = 0, last_block = 0;
+    bool found = index.lookupBlock(query, block);
+    bool range_found =
+        index.lookupBlockRange(queries[0], query, first_block, last_block);
+    if (found != (expected >= 0) || (found && (int64_t)block != expected) ||
+        range_found != found ||
+        (range_found && (first_block != 0 || last_block != block))) {
+      ok &= check(false, "block lookup on a wide root");
+      break;
+    }
+  }
+  return ok;
+}
+
+// A mapped FST answers like the one it was written from while its sparse
+// levels stay in the file; an image cut short anywhere is rejected, whatever
+// size its header claims.
+bool checkMapFile() {
+  std::vector<std::string> keys = sortedKeys(5000, 99);
+  FST fst(keys);
+  std::unique_ptr<char[]> data(fst.serialize());
+  uint64_t size = fst.serializedSize();
+  char path[] = "/tmp/is_building_test_XXXXXX";
+  int fd = mkstemp(path);
+  bool ok = check(fd >= 0 && write(fd, data.get(), size) == (ssize_t)size,
+                  "write the image");
+  if (fd >= 0) close(fd);
+  std::unique_ptr<FST> mapped(FST::mapFile(path));
+  if (!check(mapped != nullptr, "map the image")) {
+    unlink(path);
+    return false;
+  }
+  mapped->setKeys(keys);
+  ok &= check(mapped->getMemoryUsage() < fst.getMemoryUsage() / 2,
+              "sparse levels left in the mapping");
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    if (!mapped->lookupKey(keys[i], value) || value != i) {
+      ok &= check(false, "lookup in a mapped FST");
+      break;
+    }
+  }
+  FST::Iter iter = mapped->moveToKeyGreaterThan(keys[100], false);
+  ok &= check(iter.isValid() && iter.getValue() == 101,
+              "seek in a mapped FST");
+
+  // truncated on disk
+  ok &= check(truncate(path, size - 8) == 0 &&
+                  std::unique_ptr<FST>(FST::mapFile(path)) == nullptr,
+              "map a truncated file");
+  unlink(path);
+  // truncated, with the header size patched to match, so that every
+  // section length is checked against the end
+  for (uint64_t length = 16; length < size; length += 8) {
+    std::unique_ptr<char[]> cut(new char[length]);
+    memcpy(cut.get(), data.get(), length);
+    memcpy(cut.get() + 8, &length, sizeof(length));
+    std::unique_ptr<FST> copy(
+        FST::deSerialize(cut.get(), false, cut.get() + length));
+    if (copy != nullptr) {
+      ok &= check(false, "deSerialize a truncated image");
+      break;
+    }
+  }
+  return ok;
+}
+
+// serializeTo streams the bytes serialize() builds; writeFST replaces a file
+// in one rename and leaves no temporary behind.
+bool checkSerializeTo() {
+  std::vector<std::string> keys = sortedKeys(5000, 100);
+  FST fst(keys, kIncludeDense, kSparseDenseRatio, 10, kReal, 8);
+  std::unique_ptr<char[]> data(fst.serialize());
+  uint64_t size = fst.serializedSize();
+  char path[] = "/tmp/is_building_test_XXXXXX";
+  int fd = mkstemp(path);
+  bool ok = check(fd >= 0 && fst.serializeTo(fd, false), "serializeTo");
+  std::string streamed(size + 1, '\0');
+  ok &= check(pread(fd, &streamed[0], size + 1, 0) == (ssize_t)size &&
+                  memcmp(streamed.data(), data.get(), size) == 0,
+              "streamed bytes");
+  if (fd >= 0) close(fd);
+
+  std::vector<std::string> other_keys = sortedKeys(100, 1000);
+  tools::writeFST(FST(other_keys), path);
+  tools::writeFST(fst, path);
+  std::unique_ptr<FST> loaded = tools::loadFST(path);
+  loaded->setKeys(keys);
+  uint64_t value = 0;
+  ok &= check(loaded->lookupKey(keys[42], value) && value == 42,
+              "lookup after writeFST");
+  ok &= check(access((std::string(path) + ".tmp").c_str(), F_OK) != 0,
+              "temporary file renamed");
+  unlink(path);
+  bool thrown = false;
+  try {
+    tools::writeFST(fst, std::string(path) + "/missing/fst");
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  ok &= check(thrown, "writeFST into a missing directory");
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+  ok &= checkSerialize();
+  ok &= checkValuesAndLevelStats();
+  ok &= checkFalsePositiveEstimate();
+  ok &= checkBloomFilter();
+  ok &= checkRangeFilter();
+  ok &= checkKeyAtPosition();
+  ok &= checkBatchCoding();
+  ok &= checkTopK();
+  ok &= checkFuzzySearch();
+  ok &= checkPrefixKeys();
+  ok &= checkKeySetOperations();
+  ok &= checkMergingIter();
+  ok &= checkSkipTo();
+  ok &= checkSeekBatch();
+  ok &= checkSeekForPrev();
+  ok &= checkResumeTokens();
+  ok &= checkRanks();
+  ok &= checkForEachPrefix();
+  ok &= checkCardinality();
+  ok &= checkSuffixIndex();
+  ok &= checkPrefixCursor();
+  ok &= checkValueVector();
+  ok &= checkBlockIndex();
+  ok &= checkWideBlockIndex();
+  ok &= checkMapFile();
+  ok &= checkSerializeTo();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#ifndef TOOL_COMMON_H_
+#define TOOL_COMMON_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mmphf_fst.hpp>
+
+namespace mmphf_fst {
+namespace tools {
+
+// Decodes a hex string ("6b6579") into raw bytes ("key"). Throws on malformed
+// input.
+inline std::string decodeHex(const std::string &hex) {
+  auto nibble = [&hex](char c) -> int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    throw std::invalid_argument("invalid hex key: " + hex);
+  };
+  if (hex.size() % 2 != 0)
+    throw std::invalid_argument("odd length hex key: " + hex);
+  std::string bytes;
+  bytes.reserve(hex.size() / 2);
+  for (size_t i = 0; i < hex.size(); i += 2)
+    bytes.push_back((char)((nibble(hex[i]) << 4) | nibble(hex[i + 1])));
+  return bytes;
+}
+
+inline std::string encodeHex(const std::string &bytes) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(bytes.size() * 2);
+  for (unsigned char c : bytes) {
+    hex.push_back(kDigits[c >> 4]);
+    hex.push_back(kDigits[c & 0xF]);
+  }
+  return hex;
+}
+
+// Reads one key per line. Empty lines are skipped, with hex == true every line
+// is hex decoded first.
+inline std::vector<std::string> readKeyFile(const std::string &path,
+                                            const bool hex) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("cannot open key file: " + path);
+  std::vector<std::string> keys;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+    keys.emplace_back(hex ? decodeHex(line) : line);
+  }
+  return keys;
+}
+
+// FSTBuilder requires a sorted, duplicate free key list
+inline void sortAndUnique(std::vector<std::string> &keys) {
+  if (!std::is_sorted(keys.begin(), keys.end()))
+    std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+// Sorts and deduplicates keys by sorting num_threads chunks concurrently and
+// merging them pairwise in parallel rounds.
+inline void parallelSortAndUnique(std::vector<std::string> &keys,
+                                  unsigned num_threads) {
+  num_threads = std::max(1u, num_threads);
+  if (num_threads == 1 || keys.size() < 2 * num_threads) {
+    sortAndUnique(keys);
+    return;
+  }
+  std::vector<size_t> bounds;
+  for (unsigned t = 0; t <= num_threads; t++)
+    bounds.push_back(keys.size() * t / num_threads);
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; t++)
+    workers.emplace_back([&keys, &bounds, t]() {
+      std::sort(keys.begin() + bounds[t], keys.begin() + bounds[t + 1]);
+    });
+  for (auto &worker : workers) worker.join();
+
+  // merge neighbouring runs until a single run remains
+  while (bounds.size() > 2) {
+    std::vector<size_t> merged_bounds;
+    workers.clear();
+    for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+      workers.emplace_back([&keys, &bounds, i]() {
+        std::inplace_merge(keys.begin() + bounds[i],
+                           keys.begin() + bounds[i + 1],
+                           keys.begin() + bounds[i + 2]);
+      });
+      merged_bounds.push_back(bounds[i]);
+    }
+    if (bounds.size() % 2 == 0)
+      merged_bounds.push_back(bounds[bounds.size() - 2]);
+    merged_bounds.push_back(bounds.back());
+    for (auto &worker : workers) worker.join();
+    bounds.swap(merged_bounds);
+  }
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+// map == true leaves the sparse levels in a mapping of the file, see
+// FST::mapFile
+inline std::unique_ptr<FST> loadFST(const std::string &path,
+                                    const bool map = false) {
+  if (map) {
+    std::unique_ptr<FST> fst(FST::mapFile(path));
+    if (!fst) throw std::runtime_error("cannot map fst file: " + path);
+    return fst;
+  }
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) throw std::runtime_error("cannot open fst file: " + path);
+  auto size = (uint64_t)in.tellg();
+  in.seekg(0);
+  std::unique_ptr<char[]> data(new char[size]);
+  if (!in.read(data.get(), (std::streamsize)size))
+    throw std::runtime_error("cannot read fst file: " + path);
+  // deSerialize copies every component, data may be released afterwards
+  std::unique_ptr<FST> fst(
+      FST::deSerialize(data.get(), false, data.get() + size));
+  if (!fst) throw std::runtime_error("not an fst file: " + path);
+  return fst;
+}
+
+// Streams the FST (FST::serializeTo, no image is built in memory) to
+// path + ".tmp", fsyncs it and renames it over path, so that path holds
+// either its old contents or the whole new FST, never a partial one.
+inline void writeFST(const FST &fst, const std::string &path) {
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("cannot open fst file: " + tmp_path);
+  bool ok = fst.serializeTo(fd);
+  if (close(fd) != 0 || !ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    throw std::runtime_error("cannot write fst file: " + path);
+  }
+}
+
+}  // namespace tools
+}  // namespace mmphf_fst
+
+#endif  // TOOL_COMMON_H_
@@ -0,0 +1,343 @@
+// Replays a recorded query trace against an FST across multiple threads and
+// reports throughput, latency percentiles and periodic counter snapshots.
+//
+// Trace format, one operation per line ('#' starts a comment):
+//   point  <key>
+//   seek   <key>
+//   range  <left_key> <right_key>
+//   prefix <key>
+// With --hex, all keys (trace and key file) are hex encoded.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <mmphf_fst.hpp>
+
+#include "tool_common.hpp"
+
+using namespace mmphf_fst;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+enum OpType : uint8_t { kPoint = 0, kSeek, kRange, kPrefix, kNumOpTypes };
+const char *const kOpNames[kNumOpTypes] = {"point", "seek", "range", "prefix"};
+
+struct TraceOp {
+  OpType type;
+  std::string key;
+  std::string right_key;  // only used by range
+};
+
+struct Options {
+  std::string fst_path;
+  std::string key_path;
+  std::string trace_path;
+  bool hex = false;
+  bool mmap = false;  // map the fst file instead of reading it, see mapFile
+  unsigned threads = 1;
+  double rate = 0;  // ops per second over all threads, 0 = as fast as possible
+  unsigned repeat = 1;
+  double report_interval = 1.0;  // seconds, 0 disables snapshots
+  uint64_t scan_limit = 0;       // max keys per range/prefix scan, 0 = no limit
+  uint32_t bloom_bits_per_key = 0;  // only used when building from --keys
+};
+
+struct Counters {
+  std::atomic<uint64_t> ops[kNumOpTypes]{};
+  std::atomic<uint64_t> hits[kNumOpTypes]{};
+  std::atomic<uint64_t> scanned{0};
+
+  uint64_t totalOps() const {
+    uint64_t total = 0;
+    for (auto &count : ops) total += count.load(std::memory_order_relaxed);
+    return total;
+  }
+};
+
+void usage() {
+  std::cerr
+      << "usage: trace_replay (--fst <file> [--keys <file>] | --keys <file>)\n"
+         "                    --trace <file> [--threads N] [--rate OPS]\n"
+         "                    [--repeat N] [--report-interval SEC]\n"
+         "                    [--scan-limit N] [--bloom-bits B] [--hex]\n"
+         "                    [--mmap]\n";
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--fst")
+      opts.fst_path = next();
+    else if (arg == "--keys")
+      opts.key_path = next();
+    else if (arg == "--trace")
+      opts.trace_path = next();
+    else if (arg == "--threads")
+      opts.threads = std::max(1, std::stoi(next()));
+    else if (arg == "--rate")
+      opts.rate = std::stod(next());
+    else if (arg == "--repeat")
+      opts.repeat = std::max(1, std::stoi(next()));
+    else if (arg == "--report-interval")
+      opts.report_interval = std::stod(next());
+    else if (arg == "--scan-limit")
+      opts.scan_limit = std::stoull(next());
+    else if (arg == "--bloom-bits")
+      opts.bloom_bits_per_key = std::stoul(next());
+    else if (arg == "--hex")
+      opts.hex = true;
+    else if (arg == "--mmap")
+      opts.mmap = true;
+    else
+      throw std::invalid_argument("unknown argument: " + arg);
+  }
+  if (opts.trace_path.empty())
+    throw std::invalid_argument("--trace is required");
+  if (opts.fst_path.empty() && opts.key_path.empty())
+    throw std::invalid_argument("either --fst or --keys is required");
+  return opts;
+}
+
+std::vector<TraceOp> readTrace(const std::string &path, const bool hex) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("cannot open trace file: " + path);
+  std::vector<TraceOp> trace;
+  std::string line;
+  uint64_t line_num = 0;
+  while (std::getline(in, line)) {
+    line_num++;
+    std::istringstream tokens(line);
+    std::string op;
+    if (!(tokens >> op) || op[0] == '#') continue;
+
+    TraceOp trace_op{};
+    if (op == "point" || op == "get")
+      trace_op.type = kPoint;
+    else if (op == "seek")
+      trace_op.type = kSeek;
+    else if (op == "range")
+      trace_op.type = kRange;
+    else if (op == "prefix")
+      trace_op.type = kPrefix;
+    else
+      throw std::runtime_error("unknown operation '" + op + "' in line " +
+                               std::to_string(line_num));
+
+    if (!(tokens >> trace_op.key) ||
+        (trace_op.type == kRange && !(tokens >> trace_op.right_key)))
+      throw std::runtime_error("missing key in line " +
+                               std::to_string(line_num));
+    if (hex) {
+      trace_op.key = tools::decodeHex(trace_op.key);
+      if (trace_op.type == kRange)
+        trace_op.right_key = tools::decodeHex(trace_op.right_key);
+    }
+    trace.push_back(std::move(trace_op));
+  }
+  return trace;
+}
+
+// Returns true if the operation found at least one (verified) key.
+// keys may be null for point-only traces on a deserialized FST, point lookups
+// then report unverified candidates.
+bool executeOp(const FST &fst, const std::vector<std::string> *keys,
+               const TraceOp &op, const uint64_t scan_limit,
+               uint64_t &scanned) {
+  switch (op.type) {
+    case kPoint: {
+      uint64_t value = 0;
+      if (!fst.lookupKey(op.key, value)) return false;
+      return keys == nullptr || (*keys)[value] == op.key;
+    }
+    case kSeek:
+      return fst.moveToKeyGreaterThan(op.key, true).isValid();
+    case kRange:
+    case kPrefix: {
+      uint64_t count = 0;
+      for (auto iter = fst.moveToKeyGreaterThan(op.key, true);
+           iter.isValid() && (scan_limit == 0 || count < scan_limit);
+           iter++) {
+        const std::string &key = (*keys)[iter.getValue()];
+        if (op.type == kRange ? key > op.right_key
+                              : key.compare(0, op.key.size(), op.key) != 0)
+          break;
+        count++;
+      }
+      scanned += count;
+      return count > 0;
+    }
+    default:
+      return false;
+  }
+}
+
+uint64_t percentile(const std::vector<uint64_t> &sorted, const double p) {
+  if (sorted.empty()) return 0;
+  auto idx = (size_t)(p * (double)sorted.size());
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+void printLatencies(const char *name, std::vector<uint64_t> &latencies,
+                    const uint64_t hits) {
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-8s %12zu %12lu %10lu %10lu %10lu %10lu %10lu\n", name,
+         latencies.size(), hits, percentile(latencies, 0.5),
+         percentile(latencies, 0.9), percentile(latencies, 0.99),
+         percentile(latencies, 0.999),
+         latencies.empty() ? 0 : latencies.back());
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  try {
+    opts = parseOptions(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    usage();
+    return 1;
+  }
+
+  try {
+    std::vector<std::string> keys;
+    if (!opts.key_path.empty()) {
+      keys = tools::readKeyFile(opts.key_path, opts.hex);
+      tools::sortAndUnique(keys);
+    }
+
+    auto load_start = Clock::now();
+    std::unique_ptr<FST> fst;
+    if (!opts.fst_path.empty()) {
+      fst = tools::loadFST(opts.fst_path, opts.mmap);
+      if (!keys.empty()) fst->setKeys(keys);
+    } else {
+      fst = std::make_unique<FST>(keys, kIncludeDense, kSparseDenseRatio,
+                                  opts.bloom_bits_per_key);
+    }
+    double load_sec =
+        std::chrono::duration<double>(Clock::now() - load_start).count();
+
+    const std::vector<TraceOp> trace = readTrace(opts.trace_path, opts.hex);
+    if (keys.empty() &&
+        std::any_of(trace.begin(), trace.end(),
+                    [](const TraceOp &op) { return op.type != kPoint; }))
+      throw std::runtime_error(
+          "seek, range and prefix operations require --keys");
+
+    printf("fst: height %u, sparse start level %u, %lu bytes, %s in %.3f s\n",
+           fst->getHeight(), fst->getSparseStartLevel(), fst->getMemoryUsage(),
+           opts.fst_path.empty() ? "built" : opts.mmap ? "mapped" : "loaded",
+           load_sec);
+    printf("trace: %zu ops x %u, %u threads, rate %s\n", trace.size(),
+           opts.repeat, opts.threads,
+           opts.rate > 0 ? std::to_string((uint64_t)opts.rate).c_str()
+                         : "unlimited");
+
+    const uint64_t total_ops = trace.size() * opts.repeat;
+    const std::vector<std::string> *key_ptr = keys.empty() ? nullptr : &keys;
+    Counters counters;
+    std::atomic<uint64_t> cursor{0};
+    std::vector<std::vector<uint64_t>> latencies(opts.threads * kNumOpTypes);
+
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+
+    auto start = Clock::now();
+    auto worker = [&](const unsigned thread_id) {
+      auto *thread_latencies = &latencies[thread_id * kNumOpTypes];
+      uint64_t scanned = 0;
+      for (uint64_t idx = cursor.fetch_add(1); idx < total_ops;
+           idx = cursor.fetch_add(1)) {
+        if (opts.rate > 0)
+          std::this_thread::sleep_until(
+              start + std::chrono::nanoseconds(
+                          (uint64_t)((double)idx * 1e9 / opts.rate)));
+        const TraceOp &op = trace[idx % trace.size()];
+        auto op_start = Clock::now();
+        bool hit = executeOp(*fst, key_ptr, op, opts.scan_limit, scanned);
+        auto op_end = Clock::now();
+        thread_latencies[op.type].push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(op_end -
+                                                                 op_start)
+                .count());
+        counters.ops[op.type].fetch_add(1, std::memory_order_relaxed);
+        if (hit) counters.hits[op.type].fetch_add(1, std::memory_order_relaxed);
+      }
+      counters.scanned.fetch_add(scanned, std::memory_order_relaxed);
+    };
+
+    // periodically prints a snapshot of the shared counters
+    std::thread reporter([&]() {
+      if (opts.report_interval <= 0) return;
+      auto interval = std::chrono::duration<double>(opts.report_interval);
+      uint64_t last_ops = 0;
+      std::unique_lock<std::mutex> lock(done_mutex);
+      while (!done_cv.wait_for(lock, interval, [&] { return done; })) {
+        double elapsed =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        uint64_t ops = counters.totalOps();
+        printf("[%8.2f s] ops %12lu  interval %12.0f ops/s |", elapsed, ops,
+               (double)(ops - last_ops) / opts.report_interval);
+        for (unsigned type = 0; type < kNumOpTypes; type++)
+          printf(" %s %lu/%lu", kOpNames[type], counters.hits[type].load(),
+                 counters.ops[type].load());
+        printf("\n");
+        fflush(stdout);
+        last_ops = ops;
+      }
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < opts.threads; t++) workers.emplace_back(worker, t);
+    for (auto &t : workers) t.join();
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> lock(done_mutex);
+      done = true;
+    }
+    done_cv.notify_all();
+    reporter.join();
+
+    printf("\nelapsed %.3f s, %lu ops, %.0f ops/s, %lu keys scanned\n",
+           elapsed, total_ops, (double)total_ops / elapsed,
+           counters.scanned.load());
+    printf("%-8s %12s %12s %10s %10s %10s %10s %10s\n", "op", "count", "hits",
+           "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+    std::vector<uint64_t> all;
+    uint64_t all_hits = 0;
+    for (unsigned type = 0; type < kNumOpTypes; type++) {
+      std::vector<uint64_t> merged;
+      for (unsigned t = 0; t < opts.threads; t++) {
+        auto &lat = latencies[t * kNumOpTypes + type];
+        merged.insert(merged.end(), lat.begin(), lat.end());
+      }
+      if (merged.empty()) continue;
+      all.insert(all.end(), merged.begin(), merged.end());
+      all_hits += counters.hits[type].load();
+      printLatencies(kOpNames[type], merged, counters.hits[type].load());
+    }
+    printLatencies("all", all, all_hits);
+  } catch (const std::exception &e) {
+    std::cerr << "error: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}